@@ -0,0 +1,75 @@
+#include "MappedFile.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(std::string const &filename) {
+  file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    file_handle = nullptr;
+    throw std::runtime_error("Failed to open '" + filename + "'");
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size)) {
+    CloseHandle(file_handle);
+    throw std::runtime_error("Failed to get size of '" + filename + "'");
+  }
+  size = size_t(file_size.QuadPart);
+  if (size == 0) return; //can't map an empty file, but it's still a valid (empty) file
+
+  mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_handle) {
+    data = reinterpret_cast< char const * >(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (!data) {
+    if (mapping_handle) CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    throw std::runtime_error("Failed to map '" + filename + "'");
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data) UnmapViewOfFile(data);
+  if (mapping_handle) CloseHandle(mapping_handle);
+  if (file_handle) CloseHandle(file_handle);
+}
+
+#else
+
+MappedFile::MappedFile(std::string const &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open '" + filename + "'");
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("Failed to get size of '" + filename + "'");
+  }
+  size = size_t(info.st_size);
+  if (size == 0) { //can't map an empty file, but it's still a valid (empty) file
+    close(fd);
+    return;
+  }
+
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); //(the mapping stays valid after the descriptor is closed)
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map '" + filename + "'");
+  }
+  data = reinterpret_cast< char const * >(mapped);
+}
+
+MappedFile::~MappedFile() {
+  if (data) munmap(const_cast< char * >(data), size);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//"MappedFile" maps a whole file into memory (read-only), so large baked
+// assets can be loaded without streaming them through an std::istream.
+
+struct MappedFile {
+  //map a file:
+  // note: will throw if file fails to open or map.
+  MappedFile(std::string const &filename);
+  ~MappedFile();
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  char const *data = nullptr;
+  size_t size = 0;
+
+  //magic number of the chunk at 'offset' (or "" if at end of file):
+  std::string peek_magic(size_t offset) const {
+    if (offset + 4 > size) return "";
+    return std::string(data + offset, 4);
+  }
+
+  //same as read_chunk() (see read_chunk.hpp), but reads the chunk at 'offset'
+  // and advances 'offset' past it:
+  template<typename T>
+  void read_chunk(size_t *offset, std::string const &magic, std::vector<T> *_to) const {
+    assert(offset);
+    assert(_to);
+    auto &to = *_to;
+
+    struct ChunkHeader {
+      char magic[4] = {'\0', '\0', '\0', '\0'};
+      uint32_t size = 0;
+    };
+    static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+    ChunkHeader header;
+    if (*offset + sizeof(header) > size) {
+      throw std::runtime_error("Failed to read chunk header");
+    }
+    std::memcpy(&header, data + *offset, sizeof(header));
+    *offset += sizeof(header);
+    if (std::string(header.magic, 4) != magic) {
+      throw std::runtime_error("Unexpected magic number in chunk");
+    }
+
+    if (header.size % sizeof(T) != 0) {
+      throw std::runtime_error("Size of chunk not divisible by element size");
+    }
+    if (*offset + header.size > size) {
+      throw std::runtime_error("Failed to read chunk data.");
+    }
+
+    to.resize(header.size / sizeof(T));
+    if (header.size) std::memcpy(&to[0], data + *offset, header.size);
+    *offset += header.size;
+  }
+
+  //internals:
+#if defined(_WIN32)
+  void *file_handle = nullptr;
+  void *mapping_handle = nullptr;
+#endif
+};
@@ -4,6 +4,7 @@
 #include "compile_program.hpp"
 #include "MeshBuffer.hpp"
 #include "data_path.hpp"
+#include "gl_state.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
@@ -113,19 +114,19 @@ void MenuMode::draw(glm::uvec2 const &drawable_size) {
   if (background && background_fade < 1.0f) {
     background->draw(drawable_size);
 
-    glDisable(GL_DEPTH_TEST);
+    gl_disable(GL_DEPTH_TEST);
     if (background_fade > 0.0f) {
-      glEnable(GL_BLEND);
-      glBlendEquation(GL_FUNC_ADD);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-      glUseProgram(*fade_program);
+      gl_enable(GL_BLEND);
+      gl_blend_equation(GL_FUNC_ADD);
+      gl_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      gl_use_program(*fade_program);
       glUniform4fv(fade_program_color, 1, glm::value_ptr(glm::vec4(0.0f, 0.0f, 0.0f, background_fade)));
       glDrawArrays(GL_TRIANGLES, 0, 3);
-      glUseProgram(0);
-      glDisable(GL_BLEND);
+      gl_use_program(0);
+      gl_disable(GL_BLEND);
     }
   }
-  glDisable(GL_DEPTH_TEST);
+  gl_disable(GL_DEPTH_TEST);
 
   float aspect = drawable_size.x / float(drawable_size.y);
   //scale factors such that a rectangle of aspect 'aspect' and height '1.0' fills the window:
@@ -142,8 +143,8 @@ void MenuMode::draw(glm::uvec2 const &drawable_size) {
     total_height += choice.height + 2.0f * choice.padding;
   }
 
-  glUseProgram(*menu_program);
-  glBindVertexArray(*menu_binding);
+  gl_use_program(*menu_program);
+  gl_bind_vertex_array(*menu_binding);
 
   //character width and spacing helpers:
   // (...in terms of the menu font's default 3-unit height)
@@ -208,5 +209,5 @@ void MenuMode::draw(glm::uvec2 const &drawable_size) {
     y -= choice.padding;
   }
 
-  glEnable(GL_DEPTH_TEST);
+  gl_enable(GL_DEPTH_TEST);
 }
@@ -1,5 +1,6 @@
 #include "MeshBuffer.hpp"
 #include "read_chunk.hpp"
+#include "gl_state.hpp"
 
 #include <glm/glm.hpp>
 
@@ -10,6 +11,8 @@
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cmath>
+#include <algorithm>
 
 MeshBuffer::MeshBuffer(std::string const &filename) {
   glGenBuffers(1, &vbo);
@@ -17,6 +20,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
   std::ifstream file(filename, std::ios::binary);
 
   GLuint total = 0;
+  std::vector< glm::vec3 > positions; //kept to compute mesh bounds
   //read + upload data chunk:
   if (filename.size() >= 2 && filename.substr(filename.size() - 2) == ".p") {
     struct Vertex {
@@ -33,6 +37,8 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     total = GLuint(data.size()); //store total for later checks on index
+    positions.reserve(data.size());
+    for (auto const &vertex : data) positions.emplace_back(vertex.Position);
 
     //store attrib locations:
     Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -53,6 +59,8 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     total = GLuint(data.size()); //store total for later checks on index
+    positions.reserve(data.size());
+    for (auto const &vertex : data) positions.emplace_back(vertex.Position);
 
     //store attrib locations:
     Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -75,6 +83,8 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     total = GLuint(data.size()); //store total for later checks on index
+    positions.reserve(data.size());
+    for (auto const &vertex : data) positions.emplace_back(vertex.Position);
 
     //store attrib locations:
     Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -99,6 +109,8 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     total = GLuint(data.size()); //store total for later checks on index
+    positions.reserve(data.size());
+    for (auto const &vertex : data) positions.emplace_back(vertex.Position);
 
     //store attrib locations:
     Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -134,6 +146,20 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
       Mesh mesh;
       mesh.start = entry.vertex_begin;
       mesh.count = entry.vertex_end - entry.vertex_begin;
+      if (mesh.count) {
+        mesh.min = mesh.max = positions[mesh.start];
+        for (GLuint i = mesh.start; i < mesh.start + mesh.count; ++i) {
+          mesh.min = glm::min(mesh.min, positions[i]);
+          mesh.max = glm::max(mesh.max, positions[i]);
+        }
+        mesh.center = 0.5f * (mesh.min + mesh.max);
+        float radius2 = 0.0f;
+        for (GLuint i = mesh.start; i < mesh.start + mesh.count; ++i) {
+          glm::vec3 to = positions[i] - mesh.center;
+          radius2 = std::max(radius2, glm::dot(to, to));
+        }
+        mesh.radius = std::sqrt(radius2);
+      }
       bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
       if (!inserted) {
         std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh."
@@ -169,7 +195,7 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
   //create a new vertex array object:
   GLuint vao = 0;
   glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+  gl_bind_vertex_array(vao);
 
   //Try to bind all attributes in this buffer:
   std::set<GLuint> bound;
@@ -195,7 +221,7 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
   bind_attribute("Color", Color);
   bind_attribute("TexCoord", TexCoord);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  gl_bind_vertex_array(0);
 
   //Check that all active attributes were bound:
   GLint active = 0;
@@ -207,6 +233,7 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
     GLenum type = 0;
     glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
     name[99] = '\0';
+    if (std::string(name).compare(0, 9, "Instance_") == 0) continue; //(bound by Scene::draw, to its instance buffer)
     GLint location = glGetAttribLocation(program, name);
     if (!bound.count(GLuint(location))) {
       throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
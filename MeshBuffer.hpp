@@ -1,6 +1,9 @@
 #pragma once
 
 #include "GL.hpp"
+
+#include <glm/glm.hpp>
+
 #include <map>
 
 //"MeshBuffer" holds a collection of meshes loaded from a file
@@ -37,11 +40,17 @@ struct MeshBuffer {
   struct Mesh {
     GLuint start = 0;
     GLuint count = 0;
+    //bounds of the mesh's vertices (computed on load; e.g. for culling):
+    glm::vec3 min = glm::vec3(0.0f); //axis-aligned box
+    glm::vec3 max = glm::vec3(0.0f);
+    glm::vec3 center = glm::vec3(0.0f); //sphere (centered on the box)
+    float radius = 0.0f;
   };
   const Mesh &lookup(std::string const &name) const;
 
   //build a vertex array object that links this vbo to attributes to a program:
   //  will throw if program defines attributes not contained in this buffer
+  //  (except per-instance attributes, named "Instance_...", which come from elsewhere -- see Scene::draw)
   //  and warn if this buffer contains attributes not active in the program
   GLuint make_vao_for_program(GLuint program) const;
 
@@ -8,6 +8,7 @@
 #include "data_path.hpp"        //helper to get paths relative to executable
 #include "draw_text.hpp"        //helper to... um.. draw text
 #include "gl_errors.hpp"        //helper for dumpping OpenGL error messages
+#include "gl_state.hpp"         //helper to skip redundant OpenGL state changes
 #include "read_chunk.hpp"  //helper for reading a vector of structures from a file
 #include "vertex_color_program.hpp"
 
@@ -28,6 +29,12 @@ Load<GLuint> phone_bank_meshes_for_vertex_color_program(LoadTagDefault, []() {
       phone_bank_meshes->make_vao_for_program(vertex_color_program->program));
 });
 
+Load<GLuint> phone_bank_meshes_for_vertex_color_program_instanced(
+    LoadTagDefault, []() {
+      return new GLuint(phone_bank_meshes->make_vao_for_program(
+          vertex_color_program_instanced->program));
+    });
+
 Load<Sound::Sample> sample_dot(LoadTagDefault, []() {
   return new Sound::Sample(data_path("dot.wav"));
 });
@@ -54,13 +61,18 @@ PhoneBankMode::PhoneBankMode()
                               std::string const &name) {
     Scene::Object *object = scene.new_object(transform);
     object->program = vertex_color_program->program;
-    object->program_mvp_mat4 = vertex_color_program->object_to_clip_mat4;
-    object->program_mv_mat4x3 = vertex_color_program->object_to_light_mat4x3;
-    object->program_itmv_mat3 = vertex_color_program->normal_to_light_mat3;
+    object->program_matrices_block =
+        vertex_color_program->object_matrices_block;
     object->vao = *phone_bank_meshes_for_vertex_color_program;
+    // repeated meshes (e.g. the phones) get drawn as instances:
+    object->instanced_program = vertex_color_program_instanced->program;
+    object->instanced_vao =
+        *phone_bank_meshes_for_vertex_color_program_instanced;
     MeshBuffer::Mesh const &mesh = phone_bank_meshes->lookup(name);
     object->start = mesh.start;
     object->count = mesh.count;
+    object->bounds_center = mesh.center;
+    object->bounds_radius = mesh.radius;
     return object;
   };
 
@@ -98,10 +110,10 @@ PhoneBankMode::PhoneBankMode()
 
     for (const auto &entry : transforms) {
       Scene::Transform *transform = scene.new_transform();
-      transform->position = entry.position;
-      transform->rotation = glm::quat(entry.rotation.w, entry.rotation.x,
-                                      entry.rotation.y, entry.rotation.z);
-      transform->scale = entry.scale;
+      transform->set_position(entry.position);
+      transform->set_rotation(glm::quat(entry.rotation.w, entry.rotation.x,
+                                        entry.rotation.y, entry.rotation.z));
+      transform->set_scale(entry.scale);
       std::string obj_name(&strings[0] + entry.obj_name_begin,
                            &strings[0] + entry.obj_name_end);
 
@@ -145,12 +157,13 @@ PhoneBankMode::PhoneBankMode()
 
   {  // Camera looking at the origin:
     Scene::Transform *transform = scene.new_transform();
-    transform->position = player_at;
+    transform->set_position(player_at);
     // Cameras look along -z, so rotate view to look at origin:
     elev_offset = std::atan2f(
         std::sqrtf(player_up.x * player_up.x + player_up.y * player_up.y),
         player_up.z);
-    transform->rotation = glm::angleAxis(elev_offset + elevation, player_right);
+    transform->set_rotation(
+        glm::angleAxis(elev_offset + elevation, player_right));
     camera = scene.new_camera(transform);
   }
 
@@ -188,6 +201,12 @@ bool PhoneBankMode::handle_event(SDL_Event const &evt,
     }
   }
 
+  if (evt.type == SDL_KEYDOWN && evt.key.keysym.scancode == SDL_SCANCODE_F3) {
+    log_draw_stats = !log_draw_stats;
+    draw_stats_countdown = 0.0f;
+    return true;
+  }
+
   // handle activating phone
   if (evt.type == SDL_KEYDOWN &&
       evt.key.keysym.scancode == SDL_SCANCODE_SPACE && selectable_phone) {
@@ -240,9 +259,9 @@ bool PhoneBankMode::handle_event(SDL_Event const &evt,
       float pitch = evt.motion.yrel / float(window_size.y) * camera->fovy;
       azimuth -= yaw;
       elevation -= pitch;
-      camera->transform->rotation =
+      camera->transform->set_rotation(
           glm::normalize(glm::angleAxis(azimuth, player_up) *
-                         glm::angleAxis(elev_offset + elevation, player_right));
+                         glm::angleAxis(elev_offset + elevation, player_right)));
       handle_phone();
       return true;
     }
@@ -251,6 +270,8 @@ bool PhoneBankMode::handle_event(SDL_Event const &evt,
 }
 
 void PhoneBankMode::update(float elapsed) {
+  draw_stats_countdown -= elapsed;
+
   if (merits >= 10) {
     show_win_menu();
   }
@@ -262,10 +283,12 @@ void PhoneBankMode::update(float elapsed) {
   glm::mat3 directions = glm::mat3_cast(camera->transform->rotation);
   float amt = 5.0f * elapsed;
 
-  if (controls.right) walk_mesh->walk(walk_point, amt * directions[0]);
-  if (controls.left) walk_mesh->walk(walk_point, -amt * directions[0]);
-  if (controls.backward) walk_mesh->walk(walk_point, amt * directions[2]);
-  if (controls.forward) walk_mesh->walk(walk_point, -amt * directions[2]);
+  glm::vec3 step = glm::vec3(0.0f);
+  if (controls.right) step += amt * directions[0];
+  if (controls.left) step -= amt * directions[0];
+  if (controls.backward) step += amt * directions[2];
+  if (controls.forward) step -= amt * directions[2];
+  walk_mesh->walk(walk_point, step);
 
   player_up = walk_mesh->world_normal(walk_point);
   player_at = walk_mesh->world_point(walk_point) + player_up * 1.7f;
@@ -273,10 +296,10 @@ void PhoneBankMode::update(float elapsed) {
   elev_offset = std::atan2f(
       std::sqrtf(player_up.x * player_up.x + player_up.y * player_up.y),
       player_up.z);
-  camera->transform->position = player_at;
-  camera->transform->rotation =
+  camera->transform->set_position(player_at);
+  camera->transform->set_rotation(
       glm::normalize(glm::angleAxis(azimuth, player_up) *
-                     glm::angleAxis(elev_offset + elevation, player_right));
+                     glm::angleAxis(elev_offset + elevation, player_right)));
 
   handle_phone();
 
@@ -302,30 +325,47 @@ void PhoneBankMode::update(float elapsed) {
 
 void PhoneBankMode::draw(glm::uvec2 const &drawable_size) {
   // set up basic OpenGL state:
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_BLEND);
-  glBlendEquation(GL_FUNC_ADD);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-  // set up light position + color:
-  glUseProgram(vertex_color_program->program);
-  glUniform3fv(vertex_color_program->sun_color_vec3, 1,
-               glm::value_ptr(glm::vec3(0.81f, 0.81f, 0.76f)));
-  glUniform3fv(vertex_color_program->sun_direction_vec3, 1,
-               glm::value_ptr(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f))));
-  glUniform3fv(vertex_color_program->sky_color_vec3, 1,
-               glm::value_ptr(glm::vec3(0.4f, 0.4f, 0.45f)));
-  glUniform3fv(vertex_color_program->sky_direction_vec3, 1,
-               glm::value_ptr(glm::vec3(0.0f, 1.0f, 0.0f)));
-  glUseProgram(0);
+  gl_enable(GL_DEPTH_TEST);
+  gl_enable(GL_BLEND);
+  gl_blend_equation(GL_FUNC_ADD);
+  gl_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  // set up light position + color (for both versions of the program):
+  for (VertexColorProgram const *program :
+       {&*vertex_color_program, &*vertex_color_program_instanced}) {
+    gl_use_program(program->program);
+    glUniform3fv(program->sun_color_vec3, 1,
+                 glm::value_ptr(glm::vec3(0.81f, 0.81f, 0.76f)));
+    glUniform3fv(program->sun_direction_vec3, 1,
+                 glm::value_ptr(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f))));
+    glUniform3fv(program->sky_color_vec3, 1,
+                 glm::value_ptr(glm::vec3(0.4f, 0.4f, 0.45f)));
+    glUniform3fv(program->sky_direction_vec3, 1,
+                 glm::value_ptr(glm::vec3(0.0f, 1.0f, 0.0f)));
+  }
+  gl_use_program(0);
 
   // fix aspect ratio of camera
   camera->aspect = drawable_size.x / float(drawable_size.y);
 
   scene.draw(camera);
 
+  if (log_draw_stats && draw_stats_countdown <= 0.0f) {
+    draw_stats_countdown = 1.0f;
+    Scene::DrawStats const &stats = scene.draw_stats;
+    std::cout << "drawn " << stats.drawn << ", culled " << stats.culled
+              << "; changes: " << stats.program_changes << " program, "
+              << stats.vao_changes << " vao, " << stats.material_changes
+              << " material; " << stats.instanced_draws
+              << " instanced draws (" << stats.instances << " instances), "
+              << stats.matrix_blocks << " matrix blocks; gl state calls "
+              << gl_state_last_frame_counts.issued << " issued, "
+              << gl_state_last_frame_counts.skipped << " skipped"
+              << std::endl;
+  }
+
   if (Mode::current.get() == this) {
-    glDisable(GL_DEPTH_TEST);
+    gl_disable(GL_DEPTH_TEST);
     std::string message;
     if (mouse_captured) {
       message = "ESCAPE TO UNGRAB MOUSE * WASD MOVE";
@@ -417,7 +457,7 @@ void PhoneBankMode::draw(glm::uvec2 const &drawable_size) {
     draw_text(strike_str, glm::vec2(0.95f, 0.85f), height,
               glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
 
-    glUseProgram(0);
+    gl_use_program(0);
   }
 
   GL_ERRORS();
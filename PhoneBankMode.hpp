@@ -119,6 +119,11 @@ struct PhoneBankMode : public Mode {
 
   bool mouse_captured = false;
 
+  // F3 toggles logging draw statistics (culling, state changes -- see
+  // Scene::DrawStats and gl_state.hpp) to the console about once a second:
+  bool log_draw_stats = false;
+  float draw_stats_countdown = 0.0f;
+
   Scene scene;
   Scene::Camera *camera = nullptr;
 
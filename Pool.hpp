@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// "Pool" stores objects of one type in fixed-size blocks of slots:
+//  slots freed by destroy() are reused by later create() calls, so once the
+//  pool has grown to fit, creating and destroying objects doesn't allocate.
+//  Blocks never move, so pointers to pooled objects stay valid until the
+//  objects are destroyed, and iterating walks memory in order.
+// Each slot has a generation, bumped whenever its object is destroyed; a
+// Handle (slot index + generation) can be checked for staleness, unlike a
+// pointer. Each slot also records its own index next to the object, so
+// going from a pointer back to a slot index doesn't search the blocks.
+
+template <typename T, uint32_t BlockSize = 256>
+struct Pool {
+  struct Handle {
+    uint32_t index = -1U;
+    uint32_t generation = 0;
+    bool operator==(Handle const &o) const {
+      return index == o.index && generation == o.generation;
+    }
+    bool operator!=(Handle const &o) const { return !(*this == o); }
+  };
+
+  Pool() = default;
+  Pool(Pool const &) = delete;
+  Pool &operator=(Pool const &) = delete;
+  ~Pool() { clear(); }
+
+  // constructs a new object in a free slot (growing the pool if there is
+  // none):
+  template <typename... Args>
+  T *create(Args &&... args) {
+    if (free_slots.empty()) {
+      blocks.emplace_back(new Block);
+      uint32_t first = uint32_t(generations.size());
+      for (uint32_t i = 0; i < BlockSize; ++i) {
+        blocks.back()->slots[i].index = first + i;
+      }
+      generations.resize(first + BlockSize, 0);
+      alive.resize(first + BlockSize, 0);
+      // (pushed in reverse, so the lowest index is handed out first)
+      for (uint32_t i = BlockSize; i > 0; --i) {
+        free_slots.emplace_back(first + i - 1);
+      }
+    }
+    uint32_t index = free_slots.back();
+    free_slots.pop_back();
+    T *t = new (slot(index)) T(std::forward<Args>(args)...);
+    alive[index] = 1;
+    ++count;
+    return t;
+  }
+
+  void destroy(T *t) { destroy_at(index_of(t)); }
+  void destroy(Handle const &h) {
+    assert(get(h) && "destroying a stale handle");
+    destroy_at(h.index);
+  }
+
+  // the object a handle refers to, or null if it has been destroyed:
+  T *get(Handle const &h) const {
+    if (h.index >= alive.size() || !alive[h.index] ||
+        generations[h.index] != h.generation) {
+      return nullptr;
+    }
+    return slot(h.index);
+  }
+
+  Handle handle_of(T const *t) const {
+    Handle h;
+    h.index = index_of(t);
+    h.generation = generations[h.index];
+    return h;
+  }
+
+  // slot index of an object in the pool (read from its slot):
+  uint32_t index_of(T const *t) const {
+    // (the object is the first member of its Slot)
+    Slot const *s = reinterpret_cast<Slot const *>(t);
+    assert(s->index < alive.size() && slot(s->index) == t &&
+           "object is not in this pool");
+    return s->index;
+  }
+
+  // the object in slot 'index', or null if the slot is free:
+  T *at(uint32_t index) const {
+    return (index < alive.size() && alive[index] ? slot(index) : nullptr);
+  }
+  uint32_t slot_count() const { return uint32_t(alive.size()); }
+  uint32_t size() const { return count; }
+
+  // destroys every object (the blocks are kept for reuse):
+  void clear() {
+    for (uint32_t i = 0; i < alive.size(); ++i) {
+      if (alive[i]) destroy_at(i);
+    }
+  }
+
+  // iterates over live objects in slot order:
+  struct iterator {
+    Pool const *pool;
+    uint32_t index;
+    T &operator*() const { return *pool->slot(index); }
+    T *operator->() const { return pool->slot(index); }
+    iterator &operator++() {
+      do {
+        ++index;
+      } while (index < pool->alive.size() && !pool->alive[index]);
+      return *this;
+    }
+    bool operator!=(iterator const &o) const { return index != o.index; }
+    bool operator==(iterator const &o) const { return index == o.index; }
+  };
+  iterator begin() const {
+    iterator it{this, 0};
+    if (!alive.empty() && !alive[0]) ++it;
+    return it;
+  }
+  iterator end() const { return iterator{this, uint32_t(alive.size())}; }
+
+  //------ internals ------
+
+  struct Slot {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    uint32_t index;  // of this slot in the pool
+  };
+  static_assert(std::is_standard_layout<Slot>::value,
+                "Slot's storage must be at its start.");
+  struct Block {
+    Slot slots[BlockSize];
+  };
+  std::vector<std::unique_ptr<Block>> blocks;
+  std::vector<uint32_t> generations;  // per slot
+  std::vector<uint8_t> alive;         // per slot
+  std::vector<uint32_t> free_slots;   // (used as a stack)
+  uint32_t count = 0;
+
+  T *slot(uint32_t index) const {
+    return reinterpret_cast<T *>(
+        &blocks[index / BlockSize]->slots[index % BlockSize].storage);
+  }
+
+  void destroy_at(uint32_t index) {
+    assert(index < alive.size() && alive[index]);
+    // (marked dead first, so destructors that look at the pool don't see it)
+    alive[index] = 0;
+    slot(index)->~T();
+    ++generations[index];
+    free_slots.emplace_back(index);
+    --count;
+  }
+};
@@ -1,9 +1,26 @@
 #include "Scene.hpp"
+#include "gl_state.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <functional>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SCENE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+//transforms are handed to worker threads this many at a time:
+static const uint32_t TransformChunk = 256;
+//as are draws whose matrices need writing:
+static const uint32_t MatrixChunk = 256;
 
 glm::mat4 Scene::Transform::make_local_to_parent() const {
   return glm::mat4( //translate
@@ -41,19 +58,37 @@ glm::mat4 Scene::Transform::make_parent_to_local() const {
       );
 }
 
-glm::mat4 Scene::Transform::make_local_to_world() const {
-  if (parent) {
-    return parent->make_local_to_world() * make_local_to_parent();
-  } else {
-    return make_local_to_parent();
-  }
+glm::mat4 const &Scene::Transform::make_local_to_world() const {
+  if (dirty) update_world();
+  return local_to_world;
 }
 
-glm::mat4 Scene::Transform::make_world_to_local() const {
-  if (parent) {
-    return make_parent_to_local() * parent->make_world_to_local();
-  } else {
-    return make_parent_to_local();
+glm::mat4 const &Scene::Transform::make_world_to_local() const {
+  if (dirty) update_world();
+  return world_to_local;
+}
+
+void Scene::Transform::update_world() const {
+  WorldMatrixJob job;
+  job.position = &position;
+  job.rotation = &rotation;
+  job.scale = &scale;
+  //(brings the parent up to date first, if needed)
+  job.parent_local_to_world = (parent ? &parent->make_local_to_world() : nullptr);
+  job.parent_world_to_local = (parent ? &parent->world_to_local : nullptr);
+  job.local_to_world = &local_to_world;
+  job.world_to_local = &world_to_local;
+  //(the same arithmetic as the batched path in Scene::update_transforms, so results don't depend on which one ran)
+  update_world_matrices_scalar(&job, 1);
+  dirty = false;
+}
+
+void Scene::Transform::mark_dirty() {
+  //if this transform is already dirty, so is everything below it:
+  if (dirty) return;
+  dirty = true;
+  for (Transform *child = last_child; child != nullptr; child = child->prev_sibling) {
+    child->mark_dirty();
   }
 }
 
@@ -95,6 +130,8 @@ void Scene::Transform::set_parent(Transform *new_parent, Transform *before) {
     }
     if (prev_sibling) prev_sibling->next_sibling = this;
   }
+  if (scene) scene->transform_order_stale = true;
+  mark_dirty();
   DEBUG_assert_valid_pointers();
 }
 
@@ -106,105 +143,431 @@ glm::mat4 Scene::Camera::make_projection() const {
 
 //---------------------------
 
-//templated helper functions to avoid having to write the same new/delete code three times:
-template<typename T, typename... Args>
-T *list_new(T *&first, Args &&... args) {
-  T *t = new T(std::forward<Args>(args)...); //"perfect forwarding"
-  if (first) {
-    t->alloc_next = first;
-    first->alloc_prev_next = &t->alloc_next;
-  }
-  t->alloc_prev_next = &first;
-  first = t;
-  return t;
-}
-
-template<typename T>
-void list_delete(T *t) {
-  assert(t && "It is invalid to delete a null scene object [yes this is different than 'delete']");
-  assert(t->alloc_prev_next);
-  if (t->alloc_next) {
-    t->alloc_next->alloc_prev_next = t->alloc_prev_next;
-  }
-  *t->alloc_prev_next = t->alloc_next;
-  //PARANOIA:
-  t->alloc_next = nullptr;
-  t->alloc_prev_next = nullptr;
-}
-
 Scene::Transform *Scene::new_transform() {
-  return list_new<Scene::Transform>(first_transform);
+  Scene::Transform *transform = transforms.create();
+  transform->scene = this;
+  transform_order_stale = true;
+  return transform;
 }
 
 void Scene::delete_transform(Scene::Transform *transform) {
-  list_delete<Scene::Transform>(transform);
+  assert(transform && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+  transforms.destroy(transform);
+  transform_order_stale = true;
 }
 
 Scene::Object *Scene::new_object(Scene::Transform *transform) {
   assert(transform && "Scene::Object must be attached to a transform.");
-  return list_new<Scene::Object>(first_object, transform);
+  return objects.create(transform);
 }
 
 void Scene::delete_object(Scene::Object *object) {
-  list_delete<Scene::Object>(object);
+  assert(object && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+  objects.destroy(object);
 }
 
 Scene::Camera *Scene::new_camera(Scene::Transform *transform) {
   assert(transform && "Scene::Camera must be attached to a transform.");
-  return list_new<Scene::Camera>(first_camera, transform);
+  return cameras.create(transform);
+}
+
+void Scene::delete_camera(Scene::Camera *camera) {
+  assert(camera && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+  cameras.destroy(camera);
+}
+
+uint32_t Scene::new_material(Scene::Material const &material) {
+  materials.emplace_back(material);
+  return uint32_t(materials.size() - 1);
 }
 
-void Scene::delete_camera(Scene::Camera *object) {
-  list_delete<Scene::Camera>(object);
+void Scene::Material::add_parameter(GLuint location, uint32_t size, glm::vec4 const &value) {
+  if (parameter_count == MaxParameters) throw std::runtime_error("Scene::Material has no room for another parameter.");
+  if (size < 1 || size > 4) throw std::runtime_error("Scene::Material parameters must have 1-4 components.");
+  locations[parameter_count] = location;
+  sizes[parameter_count] = size;
+  values[parameter_count] = value;
+  parameter_count += 1;
+}
+
+void Scene::Material::set_uniforms() const {
+  for (uint32_t p = 0; p < parameter_count; ++p) {
+    if (sizes[p] == 1) glUniform1fv(locations[p], 1, glm::value_ptr(values[p]));
+    else if (sizes[p] == 2) glUniform2fv(locations[p], 1, glm::value_ptr(values[p]));
+    else if (sizes[p] == 3) glUniform3fv(locations[p], 1, glm::value_ptr(values[p]));
+    else glUniform4fv(locations[p], 1, glm::value_ptr(values[p]));
+  }
+}
+
+//---------------------------
+
+void Scene::sort_transforms() {
+  transform_order.clear();
+  transform_order.reserve(transforms.size());
+  transform_levels.clear();
+  //roots in pool order, then each level's children in order of their parents:
+  for (Transform const &root : transforms) {
+    if (!root.parent) transform_order.emplace_back(transforms.index_of(&root));
+  }
+  transform_levels.emplace_back(0);
+  while (transform_levels.back() < transform_order.size()) {
+    uint32_t begin = transform_levels.back();
+    uint32_t end = uint32_t(transform_order.size());
+    transform_levels.emplace_back(end);
+    for (uint32_t i = begin; i < end; ++i) {
+      Transform const *at = transforms.at(transform_order[i]);
+      //(children are linked last-to-first; walk to the first one so siblings stay in order)
+      Transform const *child = at->last_child;
+      while (child && child->prev_sibling) child = child->prev_sibling;
+      for (; child != nullptr; child = child->next_sibling) {
+        transform_order.emplace_back(transforms.index_of(child));
+      }
+    }
+  }
+  assert(transform_order.size() == transforms.size());
+  transform_order_stale = false;
+}
+
+void Scene::update_transforms() {
+  if (transform_order_stale) sort_transforms();
+  world_matrix_jobs.resize(transform_workers ? transform_workers->size() : 1);
+  //the job is wrapped once per update rather than once per level; it reads the current level's start from 'begin':
+  //(run() returns only after every chunk is done, so 'begin' can move on between levels)
+  uint32_t begin = 0;
+  std::function< void(uint32_t, uint32_t, uint32_t) > const update_chunk = [this, &begin](uint32_t chunk_begin, uint32_t chunk_end, uint32_t thread) {
+    update_transform_range(begin + chunk_begin, begin + chunk_end, world_matrix_jobs[thread]);
+  };
+  //each level only reads the (already updated) level above, so its transforms can be updated in any grouping, on any thread:
+  for (uint32_t level = 0; level + 1 < transform_levels.size(); ++level) {
+    begin = transform_levels[level];
+    uint32_t end = transform_levels[level + 1];
+    if (transform_workers) {
+      //(levels no bigger than a chunk just run on this thread)
+      transform_workers->run(end - begin, TransformChunk, update_chunk);
+    } else {
+      update_transform_range(begin, end, world_matrix_jobs[0]);
+    }
+  }
+}
+
+void Scene::update_transform_range(uint32_t begin, uint32_t end, std::vector< WorldMatrixJob > &jobs) {
+  jobs.clear();
+  for (uint32_t i = begin; i < end; ++i) {
+    Transform *transform = transforms.at(transform_order[i]);
+    if (!transform->dirty) continue;
+    WorldMatrixJob job;
+    job.position = &transform->position;
+    job.rotation = &transform->rotation;
+    job.scale = &transform->scale;
+    job.parent_local_to_world = (transform->parent ? &transform->parent->local_to_world : nullptr);
+    job.parent_world_to_local = (transform->parent ? &transform->parent->world_to_local : nullptr);
+    job.local_to_world = &transform->local_to_world;
+    job.world_to_local = &transform->world_to_local;
+    jobs.emplace_back(job);
+    transform->dirty = false;
+  }
+  if (!jobs.empty()) {
+    update_world_matrices(jobs.data(), uint32_t(jobs.size()));
+  }
+}
+
+//marks which spheres (as structure-of-arrays, 'count' a multiple of four) are at least partly on the inner side of every plane:
+//(planes are (normal, offset) with unit normals pointing into the view volume)
+static void cull_spheres(glm::vec4 const *planes, uint32_t plane_count,
+    float const *x, float const *y, float const *z, float const *radius, uint32_t count, uint8_t *visible) {
+  assert(count % 4 == 0);
+#ifdef SCENE_SSE
+  for (uint32_t i = 0; i < count; i += 4) {
+    __m128 cx = _mm_loadu_ps(x + i);
+    __m128 cy = _mm_loadu_ps(y + i);
+    __m128 cz = _mm_loadu_ps(z + i);
+    __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+    __m128 inside = _mm_cmpeq_ps(cx, cx); //(all ones, except for NaN centers)
+    for (uint32_t p = 0; p < plane_count; ++p) {
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), cx), _mm_mul_ps(_mm_set1_ps(planes[p].y), cy)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), cz), _mm_set1_ps(planes[p].w)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (uint32_t lane = 0; lane < 4; ++lane) {
+      visible[i + lane] = uint8_t((mask >> lane) & 1);
+    }
+  }
+#else
+  for (uint32_t i = 0; i < count; ++i) {
+    bool inside = true;
+    for (uint32_t p = 0; p < plane_count; ++p) {
+      float d = (planes[p].x * x[i] + planes[p].y * y[i]) + (planes[p].z * z[i] + planes[p].w);
+      inside = inside && (d >= -radius[i]);
+    }
+    visible[i] = uint8_t(inside);
+  }
+#endif
+}
+
+//a 31-bit code that increases with (non-negative) depth:
+//(the bits of a positive float sort the same way as the float itself, so dropping low bits just coarsens it)
+static uint64_t depth_code(float depth) {
+  depth = std::max(depth, 0.0f);
+  uint32_t bits;
+  std::memcpy(&bits, &depth, sizeof(bits));
+  return uint64_t(bits) & 0x7fffffff;
 }
 
 void Scene::draw(Scene::Camera const *camera) {
   assert(camera && "Must have a camera to draw scene from.");
 
-  glm::mat4 world_to_camera = camera->transform->make_world_to_local();
+  update_transforms();
+
+  glm::mat4 const &world_to_camera = camera->transform->make_world_to_local();
   glm::mat4 world_to_clip = camera->make_projection() * world_to_camera;
 
-  for (Scene::Object *object = first_object; object != nullptr; object = object->alloc_next) {
-    glm::mat4 local_to_world = object->transform->make_local_to_world();
+  //view volume planes, from the rows of world_to_clip (a point is inside when -w <= x,y,z <= w in clip space):
+  //(no far plane -- the projection is infinite)
+  glm::vec4 planes[5];
+  {
+    glm::mat4 rows = glm::transpose(world_to_clip);
+    planes[0] = rows[3] + rows[0]; //left
+    planes[1] = rows[3] - rows[0]; //right
+    planes[2] = rows[3] + rows[1]; //bottom
+    planes[3] = rows[3] - rows[1]; //top
+    planes[4] = rows[3] + rows[2]; //near
+    for (auto &plane : planes) {
+      float length = glm::length(glm::vec3(plane));
+      if (length > 0.0f) plane /= length;
+    }
+  }
+
+  //gather world-space bounding spheres:
+  cull_objects.clear();
+  cull_x.clear();
+  cull_y.clear();
+  cull_z.clear();
+  cull_radius.clear();
+  for (Scene::Object const &object : objects) {
+    glm::mat4 const &local_to_world = object.transform->make_local_to_world();
+    glm::vec3 center = glm::vec3(local_to_world * glm::vec4(object.bounds_center, 1.0f));
+    //(scaled by the largest axis scale, so non-uniform scales are covered)
+    float scale2 = std::max(glm::dot(local_to_world[0], local_to_world[0]),
+        std::max(glm::dot(local_to_world[1], local_to_world[1]), glm::dot(local_to_world[2], local_to_world[2])));
+    cull_objects.emplace_back(&object);
+    cull_x.emplace_back(center.x);
+    cull_y.emplace_back(center.y);
+    cull_z.emplace_back(center.z);
+    cull_radius.emplace_back(object.bounds_radius * std::sqrt(scale2));
+  }
+  uint32_t count = uint32_t(cull_objects.size());
+  uint32_t padded = (count + 3) / 4 * 4;
+  cull_x.resize(padded, 0.0f);
+  cull_y.resize(padded, 0.0f);
+  cull_z.resize(padded, 0.0f);
+  cull_radius.resize(padded, 0.0f);
+  cull_visible.resize(padded);
+  cull_spheres(planes, 5, cull_x.data(), cull_y.data(), cull_z.data(), cull_radius.data(), padded, cull_visible.data());
 
-    //compute modelview+projection (object space to clip space) matrix for this object:
-    glm::mat4 mvp = world_to_clip * local_to_world;
+  draw_stats = DrawStats();
 
-    //compute modelview (object space to camera local space) matrix for this object:
-    glm::mat4 mv = local_to_world;
+  //build sort keys for the visible objects:
+  // opaque:  0 | program:12 | vao:12 | material:12 | start:12 | coarse depth:15 -- grouped by state (and mesh, for instancing), then roughly front to back
+  //  (objects that can be instanced get depth 0, so they stay in one run rather than interleaving with the ones that can't)
+  // blended: 1 | far-to-near depth:31 | program:16 | vao:16 -- back to front, after every opaque object
+  //(names are truncated to fit; that can only cost an extra state change, since binds compare the real values)
+  draw_queue.clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!cull_visible[i]) {
+      draw_stats.culled += 1;
+      continue;
+    }
+    Object const *object = cull_objects[i];
+    assert(object->material < materials.size() && "Scene::Object::material must index Scene::materials.");
+    float depth = -(world_to_camera[0][2] * cull_x[i] + world_to_camera[1][2] * cull_y[i] + world_to_camera[2][2] * cull_z[i] + world_to_camera[3][2]);
+    uint64_t key;
+    if (object->blended) {
+      key = (1ULL << 63) | ((0x7fffffff - depth_code(depth)) << 32) | (uint64_t(object->program & 0xffff) << 16) | (object->vao & 0xffff);
+    } else {
+      key = (uint64_t(object->program & 0xfff) << 51) | (uint64_t(object->vao & 0xfff) << 39) | (uint64_t(object->material & 0xfff) << 27)
+        | (uint64_t(object->start & 0xfff) << 15);
+      if (!(object->instanced_program && materials[object->material].parameter_count == 0)) key |= depth_code(depth) >> 16;
+    }
+    draw_queue.emplace_back(DrawItem{key, object, 0});
+  }
+  std::sort(draw_queue.begin(), draw_queue.end(), [](DrawItem const &a, DrawItem const &b) {
+    return a.key < b.key;
+  });
 
-    //NOTE: inverse cancels out transpose unless there is scale involved
-    glm::mat3 itmv = glm::inverse(glm::transpose(glm::mat3(mv)));
+  //split the queue into draw calls, finding runs of objects that can be drawn as instances of one mesh:
+  for (uint32_t i = 0; i < draw_queue.size(); ) {
+    Scene::Object const *object = draw_queue[i].object;
+    uint32_t end = i + 1;
+    //(material parameters are set on 'program', so only objects whose material has none can switch to 'instanced_program')
+    if (object->instanced_program && !object->blended && materials[object->material].parameter_count == 0) {
+      while (end < draw_queue.size()) {
+        Scene::Object const *other = draw_queue[end].object;
+        if (other->instanced_program != object->instanced_program || other->instanced_vao != object->instanced_vao
+          || other->program != object->program || other->vao != object->vao
+          || other->start != object->start || other->count != object->count
+          || other->blended || other->material != object->material) break;
+        ++end;
+      }
+    }
+    draw_queue[i].run_end = end;
+    i = end;
+  }
 
-    //set up program uniforms:
-    glUseProgram(object->program);
-    if (object->program_mvp_mat4 != -1U) {
-      glUniformMatrix4fv(object->program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(mvp));
+  //write matrices for the single draws that read them from a uniform block:
+  //(plain memory writes, so they can be spread over the worker threads; entries of other draws are left unwritten)
+  uint8_t *matrices = object_matrices_ring.begin(uint32_t(draw_queue.size()));
+  GLsizeiptr matrices_stride = object_matrices_ring.stride;
+  auto write_matrices = [&](uint32_t begin, uint32_t end, uint32_t) {
+    for (uint32_t i = begin; i < end; ++i) {
+      DrawItem const &item = draw_queue[i];
+      if (item.run_end != i + 1 || item.object->program_matrices_block == -1U) continue;
+      glm::mat4 const &local_to_world = item.object->transform->make_local_to_world();
+      glm::mat4 const &world_to_local = item.object->transform->make_world_to_local();
+      ObjectMatrices data;
+      data.object_to_clip = world_to_clip * local_to_world;
+      for (uint32_t c = 0; c < 4; ++c) {
+        data.object_to_light[c] = glm::vec4(glm::vec3(local_to_world[c]), 0.0f);
+      }
+      //(normal_to_light is the transposed inverse, as below)
+      for (uint32_t c = 0; c < 3; ++c) {
+        data.normal_to_light[c] = glm::vec4(world_to_local[0][c], world_to_local[1][c], world_to_local[2][c], 0.0f);
+      }
+      std::memcpy(matrices + i * matrices_stride, &data, sizeof(data));
     }
-    if (object->program_mv_mat4x3 != -1U) {
-      glUniformMatrix4x3fv(object->program_mv_mat4x3, 1, GL_FALSE, glm::value_ptr(mv));
+  };
+  if (transform_workers) {
+    transform_workers->run(uint32_t(draw_queue.size()), MatrixChunk, write_matrices);
+  } else {
+    write_matrices(0, uint32_t(draw_queue.size()), 0);
+  }
+  object_matrices_ring.upload();
+
+  //submit, only changing state when it differs from the previous draw:
+  GLuint current_program = 0;
+  GLuint current_vao = 0;
+  uint32_t current_material = 0;
+  bool first = true;
+  //returns true if the program changed:
+  auto use_program = [&](GLuint program) {
+    if (!first && program == current_program) return false;
+    gl_use_program(program);
+    current_program = program;
+    draw_stats.program_changes += 1;
+    return true;
+  };
+  auto bind_vao = [&](GLuint vao) {
+    if (!first && vao == current_vao) return;
+    gl_bind_vertex_array(vao);
+    current_vao = vao;
+    draw_stats.vao_changes += 1;
+  };
+
+  //(i is advanced past however many objects each draw covers)
+  for (uint32_t i = 0; i < draw_queue.size(); ) {
+    Scene::Object const *object = draw_queue[i].object;
+    uint32_t end = draw_queue[i].run_end;
+
+    if (end - i >= 2) {
+      //stream per-instance matrices:
+      instance_data.clear();
+      for (uint32_t j = i; j < end; ++j) {
+        Transform const *transform = draw_queue[j].object->transform;
+        instance_data.emplace_back();
+        InstanceData &data = instance_data.back();
+        data.object_to_clip = world_to_clip * transform->make_local_to_world();
+        data.object_to_light = glm::mat4x3(transform->make_local_to_world());
+        data.normal_to_light = glm::transpose(glm::mat3(transform->make_world_to_local()));
+      }
+
+      use_program(object->instanced_program);
+      bind_vao(object->instanced_vao);
+      first = false;
+
+      if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+      glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+      //(re-specifying the whole buffer lets the driver hand over fresh storage instead of waiting on draws still using the old contents)
+      glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(InstanceData), instance_data.data(), GL_STREAM_DRAW);
+      //point the instance attributes at it, one column at a time:
+      //(done for every instanced draw, since vaos may be shared with other scenes and their instance buffers)
+      auto instance_attrib = [](GLuint location, GLint size, size_t offset) {
+        glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLbyte *) 0 + offset);
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+      };
+      for (GLuint c = 0; c < 4; ++c) {
+        instance_attrib(InstanceObjectToClipLocation + c, 4, offsetof(InstanceData, object_to_clip) + c * sizeof(glm::vec4));
+        instance_attrib(InstanceObjectToLightLocation + c, 3, offsetof(InstanceData, object_to_light) + c * sizeof(glm::vec3));
+      }
+      for (GLuint c = 0; c < 3; ++c) {
+        instance_attrib(InstanceNormalToLightLocation + c, 3, offsetof(InstanceData, normal_to_light) + c * sizeof(glm::vec3));
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      glDrawArraysInstanced(GL_TRIANGLES, object->start, object->count, GLsizei(end - i));
+      draw_stats.drawn += end - i;
+      draw_stats.instanced_draws += 1;
+      draw_stats.instances += end - i;
+      i = end;
+      continue;
     }
-    if (object->program_itmv_mat3 != -1U) {
-      glUniformMatrix3fv(object->program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
+
+    draw_stats.drawn += 1;
+
+    //set up program uniforms:
+    bool program_changed = use_program(object->program);
+    if (object->program_matrices_block != -1U) {
+      object_matrices_ring.bind(i);
+      draw_stats.matrix_blocks += 1;
+    } else {
+      glm::mat4 const &local_to_world = object->transform->make_local_to_world();
+
+      //compute modelview+projection (object space to clip space) matrix for this object:
+      glm::mat4 mvp = world_to_clip * local_to_world;
+
+      //compute modelview (object space to camera local space) matrix for this object:
+      glm::mat4 const &mv = local_to_world;
+
+      //NOTE: inverse cancels out transpose unless there is scale involved
+      //(the cached world-to-local matrix already holds the inverse, so it just needs transposing)
+      glm::mat3 itmv = glm::transpose(glm::mat3(object->transform->make_world_to_local()));
+
+      if (object->program_mvp_mat4 != -1U) {
+        glUniformMatrix4fv(object->program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(mvp));
+      }
+      if (object->program_mv_mat4x3 != -1U) {
+        glUniformMatrix4x3fv(object->program_mv_mat4x3, 1, GL_FALSE, glm::value_ptr(mv));
+      }
+      if (object->program_itmv_mat3 != -1U) {
+        glUniformMatrix3fv(object->program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
+      }
     }
 
-    if (object->set_uniforms) object->set_uniforms();
+    //(uniforms belong to the program, so a program change means the material needs setting again)
+    if (program_changed || object->material != current_material) {
+      materials[object->material].set_uniforms();
+      current_material = object->material;
+      draw_stats.material_changes += 1;
+    }
 
-    glBindVertexArray(object->vao);
+    bind_vao(object->vao);
+    first = false;
 
     //draw the object:
     glDrawArrays(GL_TRIANGLES, object->start, object->count);
+    ++i;
   }
+
+  //(lets the ring know when this frame's entries are no longer needed)
+  object_matrices_ring.end();
 }
 
 Scene::~Scene() {
-  while (first_camera) {
-    delete_camera(first_camera);
-  }
-  while (first_object) {
-    delete_object(first_object);
-  }
-  while (first_transform) {
-    delete_transform(first_transform);
+  if (instance_buffer != 0) {
+    glDeleteBuffers(1, &instance_buffer);
+    instance_buffer = 0;
   }
+  cameras.clear();
+  objects.clear();
+  transforms.clear();
 }
@@ -1,23 +1,35 @@
 #pragma once
 
 #include "GL.hpp"
+#include "Pool.hpp"
+#include "TransformKernels.hpp"
+#include "UniformRing.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 #include <vector>
 #include <list>
-#include <functional>
+#include <limits>
 
 //"Scene" manages a hierarchy of transformations with, potentially, attached information.
 struct Scene {
 
   struct Transform {
     //simple specification:
+    //NOTE: world matrices are cached, so change these through the setters below (or call mark_dirty() after writing them directly)
     glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
     glm::quat rotation = glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
     glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
 
+    void set_position(glm::vec3 const &position_) { position = position_; mark_dirty(); }
+    void set_rotation(glm::quat const &rotation_) { rotation = rotation_; mark_dirty(); }
+    void set_scale(glm::vec3 const &scale_) { scale = scale_; mark_dirty(); }
+
+    //flag the cached world matrices of this transform and everything below it as out of date:
+    void mark_dirty();
+
     //hierarchy information:
     Transform *parent = nullptr;
     Transform *last_child = nullptr;
@@ -34,8 +46,16 @@ struct Scene {
     //computed from the above:
     glm::mat4 make_local_to_parent() const;
     glm::mat4 make_parent_to_local() const;
-    glm::mat4 make_local_to_world() const;
-    glm::mat4 make_world_to_local() const;
+    //(world matrices are cached; only transforms marked dirty since the last call, and their descendants, get recomputed)
+    glm::mat4 const &make_local_to_world() const;
+    glm::mat4 const &make_world_to_local() const;
+
+    //cached world matrices, valid when 'dirty' is false:
+    //NOTE: a dirty transform's descendants are always dirty too, which lets mark_dirty() stop early
+    mutable glm::mat4 local_to_world = glm::mat4(1.0f);
+    mutable glm::mat4 world_to_local = glm::mat4(1.0f);
+    mutable bool dirty = true;
+    void update_world() const;
 
     //constructor/destructor:
     Transform() = default;
@@ -49,9 +69,8 @@ struct Scene {
       }
     }
 
-    //used by Scene to manage allocation:
-    Transform **alloc_prev_next = nullptr;
-    Transform *alloc_next = nullptr;
+    //the scene that allocated this transform (told when the hierarchy changes, so it can re-sort):
+    Scene *scene = nullptr;
   };
 
   //"Object"s contain information needed to render meshes:
@@ -66,19 +85,30 @@ struct Scene {
     GLuint program_mvp_mat4 = -1U; //uniform index for object-to-clip matrix (mat4)
     GLuint program_mv_mat4x3 = -1U; //uniform index for model-to-lighting-space matrix (mat4x3)
     GLuint program_itmv_mat3 = -1U; //uniform index for normal-to-lighting-space matrix (mat3)
+    //uniform block index of the program's "ObjectMatrices" block, if it has one (see Scene::ObjectMatrices);
+    //the matrices are then streamed through a uniform buffer and the three uniform indices above are ignored:
+    GLuint program_matrices_block = -1U;
 
-    //material info:
-    std::function<void()>
-        set_uniforms; //will be called before rendering object, use to set material parameters (e.g. glossiness)
+    //material info: index into Scene::materials (whose parameters must be uniforms of 'program'); 0 is the empty default material:
+    uint32_t material = 0;
+    //blended objects are drawn after all others, back to front (opaque objects go roughly front to back):
+    bool blended = false;
 
     //attribute info:
     GLuint vao = 0;
     GLuint start = 0;
     GLuint count = 0;
 
-    //used by Scene to manage allocation:
-    Object **alloc_prev_next = nullptr;
-    Object *alloc_next = nullptr;
+    //instancing (optional): visible objects with the same program, vao, start, count and instanced_program, and a material without parameters,
+    //are drawn together with one glDrawArraysInstanced, by 'instanced_program' through 'instanced_vao':
+    //(the instanced program reads its matrices from per-instance attributes -- see InstanceData below)
+    GLuint instanced_program = 0;
+    GLuint instanced_vao = 0; //made for instanced_program (MeshBuffer::make_vao_for_program leaves the instance attributes alone)
+
+    //object-space bounding sphere used for view culling (e.g. copy MeshBuffer::Mesh's center and radius):
+    //(the default infinite radius means the object is never culled)
+    glm::vec3 bounds_center = glm::vec3(0.0f);
+    float bounds_radius = std::numeric_limits< float >::infinity();
   };
 
   //"Camera"s contain information needed to view a scene:
@@ -95,10 +125,22 @@ struct Scene {
     float near = 0.01f; //near plane
     //computed from the above:
     glm::mat4 make_projection() const;
+  };
 
-    //used by Scene to manage allocation:
-    Camera **alloc_prev_next = nullptr;
-    Camera *alloc_next = nullptr;
+  //"Material"s hold uniform values (e.g. glossiness) shared by the objects that refer to them:
+  //(draw() sorts objects by material and only sets a material's uniforms when it differs from the previous draw's)
+  struct Material {
+    //a small block of float / vec2 / vec3 / vec4 uniforms; locations are in the program of the objects using the material:
+    static constexpr uint32_t MaxParameters = 4;
+    uint32_t parameter_count = 0;
+    GLuint locations[MaxParameters];
+    uint32_t sizes[MaxParameters]; //components (1-4)
+    glm::vec4 values[MaxParameters]; //(only the first 'size' components are used)
+
+    //append a parameter (throws if the block is full):
+    void add_parameter(GLuint location, uint32_t size, glm::vec4 const &value);
+    //set the uniforms of the program currently in use:
+    void set_uniforms() const;
   };
 
   //------ functions to create / destroy scene things -----
@@ -119,17 +161,96 @@ struct Scene {
   //Delete a camera:
   void delete_camera(Camera *);
 
-  //used to manage allocated objects:
-  Transform *first_transform = nullptr;
-  Object *first_object = nullptr;
-  Camera *first_camera = nullptr;
-  //(you shouldn't be manipulating these pointers directly
+  //Add a material, returning its index (for Object::material):
+  uint32_t new_material(Material const &material);
+
+  //storage for allocated things, in pools (see Pool.hpp) so creating and deleting them doesn't hit malloc and iterating them walks memory in order:
+  //(pointers stay valid until the thing is deleted; use e.g. transforms.handle_of() for a handle that can tell when it has been)
+  Pool< Transform > transforms;
+  Pool< Object > objects;
+  Pool< Camera > cameras;
+  //materials, by index (materials[0] is the empty default; materials are never deleted):
+  std::vector< Material > materials = std::vector< Material >(1);
 
   //------ functions to traverse the scene ------
 
+  //Bring the cached world matrices of every transform up to date, one depth level at a time:
+  //(called by draw; only transforms that changed, and their descendants, are recomputed -- in batches, see TransformKernels.hpp)
+  void update_transforms();
+
+  //if set, update_transforms() splits each big level of the hierarchy across these threads:
+  //(the results are bit-for-bit the same as updating on one thread; the pool is not owned by the scene)
+  WorkerPool *transform_workers = nullptr;
+
   //Draw the scene from a given camera by computing appropriate matrices and sending all objects to OpenGL:
+  //(objects whose bounding spheres are entirely outside the camera's view are skipped before any GL calls)
   //"camera" must be non-null!
   void draw(Camera const *camera);
 
-  ~Scene(); //destructor deallocates transforms, objects, cameras
+  //counts from the most recent draw():
+  struct DrawStats {
+    uint32_t drawn = 0;
+    uint32_t culled = 0;
+    uint32_t program_changes = 0; //program switches (see also gl_state.hpp, which counts calls OpenGL actually got)
+    uint32_t vao_changes = 0; //vertex array switches
+    uint32_t material_changes = 0; //material switches (Material::set_uniforms calls)
+    uint32_t instanced_draws = 0; //glDrawArraysInstanced calls
+    uint32_t instances = 0; //objects drawn by those calls
+    uint32_t matrix_blocks = 0; //objects whose matrices came from the uniform ring (rather than glUniformMatrix* calls)
+  };
+  DrawStats draw_stats;
+
+  //per-instance data streamed to instanced programs (one per instance, tightly packed), and the attribute locations its matrices are bound to:
+  //(matrices take one location per column)
+  struct InstanceData {
+    glm::mat4 object_to_clip;
+    glm::mat4x3 object_to_light;
+    glm::mat3 normal_to_light;
+  };
+  static constexpr GLuint InstanceObjectToClipLocation = 4;
+  static constexpr GLuint InstanceObjectToLightLocation = 8;
+  static constexpr GLuint InstanceNormalToLightLocation = 12;
+
+  //per-object matrices as laid out in a program's "ObjectMatrices" uniform block, which must be declared as:
+  //  layout(std140) uniform ObjectMatrices { mat4 object_to_clip; mat4x3 object_to_light; mat3 normal_to_light; };
+  //and bound to uniform buffer binding point ObjectMatricesBinding (with glUniformBlockBinding):
+  struct ObjectMatrices {
+    glm::mat4 object_to_clip;
+    glm::vec4 object_to_light[4]; //(std140 pads every matrix column to a vec4)
+    glm::vec4 normal_to_light[3];
+  };
+  static constexpr GLuint ObjectMatricesBinding = 0;
+
+  //pool indices of all transforms in breadth-first order (so parents come before children); rebuilt when the hierarchy changes:
+  std::vector< uint32_t > transform_order;
+  //transform_order[ transform_levels[d], transform_levels[d+1] ) are the transforms at depth d (roots are depth 0):
+  //(transforms on the same level never depend on each other, so each level can be updated as one batch)
+  std::vector< uint32_t > transform_levels;
+  bool transform_order_stale = true;
+  void sort_transforms();
+
+  //scratch space for draw(): world-space bounding spheres of all objects, as structure-of-arrays padded to a multiple of four:
+  std::vector< Object const * > cull_objects;
+  std::vector< float > cull_x, cull_y, cull_z, cull_radius;
+  std::vector< uint8_t > cull_visible;
+  //visible objects, sorted by key before submission (see draw()):
+  struct DrawItem {
+    uint64_t key;
+    Object const *object;
+    uint32_t run_end; //for the first item of each draw call: one past its last item (items in between are instances)
+  };
+  std::vector< DrawItem > draw_queue;
+  //instance data for the current instanced draw, and the buffer it is streamed to (created on first use):
+  std::vector< InstanceData > instance_data;
+  GLuint instance_buffer = 0;
+  //per-object matrices for this frame's draws (entry i belongs to draw_queue[i]; only single draws with a matrix block use theirs):
+  //(written by transform_workers, if set, since filling them needs no OpenGL calls)
+  UniformRing object_matrices_ring{ObjectMatricesBinding, sizeof(ObjectMatrices)};
+
+  //scratch space for update_transforms(), per thread:
+  std::vector< std::vector< WorldMatrixJob > > world_matrix_jobs;
+  //update [begin,end) of transform_order (all on one level):
+  void update_transform_range(uint32_t begin, uint32_t end, std::vector< WorldMatrixJob > &jobs);
+
+  ~Scene(); //destructor deallocates transforms, objects, cameras (and the instance buffer and matrix ring)
 };
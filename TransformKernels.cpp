@@ -0,0 +1,208 @@
+#include "TransformKernels.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRANSFORM_KERNELS_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// roots are treated as having identity parents, which keeps the arithmetic
+// the same for every job (multiplying by exact ones and zeros is exact):
+glm::mat4 const Identity = glm::mat4(1.0f);
+
+}  // namespace
+
+// The arithmetic below is written once per element on purpose, in the same
+// order as the SSE path (mul then add, left to right), so results match bit
+// for bit. (That assumes the compiler doesn't fuse multiply-adds, which it
+// won't unless FMA instructions are enabled, e.g. by -march=native.)
+
+void update_world_matrices_scalar(WorldMatrixJob const *jobs, uint32_t count) {
+  for (uint32_t j = 0; j < count; ++j) {
+    WorldMatrixJob const &job = jobs[j];
+    glm::vec3 const &p = *job.position;
+    glm::quat const &q = *job.rotation;
+    glm::vec3 const &s = *job.scale;
+    glm::mat4 const &pw =
+        (job.parent_local_to_world ? *job.parent_local_to_world : Identity);
+    glm::mat4 const &pi =
+        (job.parent_world_to_local ? *job.parent_world_to_local : Identity);
+
+    // rotation matrix (as glm::mat4_cast), r[column][row]:
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    float r[3][3];
+    r[0][0] = 1.0f - 2.0f * (yy + zz);
+    r[0][1] = 2.0f * (xy + wz);
+    r[0][2] = 2.0f * (xz - wy);
+    r[1][0] = 2.0f * (xy - wz);
+    r[1][1] = 1.0f - 2.0f * (xx + zz);
+    r[1][2] = 2.0f * (yz + wx);
+    r[2][0] = 2.0f * (xz + wy);
+    r[2][1] = 2.0f * (yz - wx);
+    r[2][2] = 1.0f - 2.0f * (xx + yy);
+
+    float inv_s[3];
+    for (uint32_t k = 0; k < 3; ++k) {
+      inv_s[k] = (s[k] == 0.0f ? 0.0f : 1.0f / s[k]);
+    }
+
+    // local-to-parent (translate * rotate * scale) and parent-to-local
+    // (un-scale * un-rotate * un-translate), top three rows:
+    float l[4][3], li[4][3];
+    for (uint32_t c = 0; c < 3; ++c) {
+      for (uint32_t k = 0; k < 3; ++k) {
+        l[c][k] = r[c][k] * s[c];
+        li[c][k] = r[k][c] * inv_s[k];
+      }
+    }
+    for (uint32_t k = 0; k < 3; ++k) {
+      l[3][k] = p[k];
+      li[3][k] = -(inv_s[k] * (r[k][0] * p.x + r[k][1] * p.y + r[k][2] * p.z));
+    }
+
+    glm::mat4 &w = *job.local_to_world;
+    glm::mat4 &wi = *job.world_to_local;
+    for (uint32_t c = 0; c < 4; ++c) {
+      for (uint32_t k = 0; k < 3; ++k) {
+        // world = parent_world * local:
+        float a = pw[0][k] * l[c][0] + pw[1][k] * l[c][1] + pw[2][k] * l[c][2];
+        // inverse world = parent_to_local * parent_inverse_world:
+        float b =
+            li[0][k] * pi[c][0] + li[1][k] * pi[c][1] + li[2][k] * pi[c][2];
+        if (c == 3) {
+          a = a + pw[3][k];
+          b = b + li[3][k];
+        }
+        w[c][k] = a;
+        wi[c][k] = b;
+      }
+      w[c][3] = (c == 3 ? 1.0f : 0.0f);
+      wi[c][3] = (c == 3 ? 1.0f : 0.0f);
+    }
+  }
+}
+
+#ifdef TRANSFORM_KERNELS_SSE
+
+void update_world_matrices(WorldMatrixJob const *jobs, uint32_t count) {
+  // SoA register layout: each __m128 holds one value for four jobs.
+  __m128 const one = _mm_set1_ps(1.0f);
+  __m128 const two = _mm_set1_ps(2.0f);
+  __m128 const zero = _mm_setzero_ps();
+  __m128 const sign = _mm_set1_ps(-0.0f);
+
+  for (uint32_t j = 0; j < count; j += 4) {
+    // a short final group repeats its last job (rather than switching to the
+    // scalar loop), so each job's result is independent of how jobs are
+    // grouped:
+    WorldMatrixJob const *g[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+      g[i] = &jobs[(j + i < count ? j + i : count - 1)];
+    }
+
+#define GATHER(EXPR) \
+  _mm_set_ps(g[3]->EXPR, g[2]->EXPR, g[1]->EXPR, g[0]->EXPR)
+    __m128 px = GATHER(position->x), py = GATHER(position->y),
+           pz = GATHER(position->z);
+    __m128 qx = GATHER(rotation->x), qy = GATHER(rotation->y),
+           qz = GATHER(rotation->z), qw = GATHER(rotation->w);
+    __m128 s[3] = {GATHER(scale->x), GATHER(scale->y), GATHER(scale->z)};
+#undef GATHER
+
+    // parent matrices, transposed into SoA: parent[c][k] is row k of column
+    // c for all four jobs:
+    __m128 pw[4][4], pi[4][4];
+    for (uint32_t c = 0; c < 4; ++c) {
+      for (uint32_t i = 0; i < 4; ++i) {
+        glm::mat4 const &m = (g[i]->parent_local_to_world
+                                  ? *g[i]->parent_local_to_world
+                                  : Identity);
+        glm::mat4 const &mi = (g[i]->parent_world_to_local
+                                   ? *g[i]->parent_world_to_local
+                                   : Identity);
+        pw[c][i] = _mm_loadu_ps(&m[c][0]);
+        pi[c][i] = _mm_loadu_ps(&mi[c][0]);
+      }
+      _MM_TRANSPOSE4_PS(pw[c][0], pw[c][1], pw[c][2], pw[c][3]);
+      _MM_TRANSPOSE4_PS(pi[c][0], pi[c][1], pi[c][2], pi[c][3]);
+    }
+
+    __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy),
+           zz = _mm_mul_ps(qz, qz);
+    __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz),
+           yz = _mm_mul_ps(qy, qz);
+    __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy),
+           wz = _mm_mul_ps(qw, qz);
+    __m128 r[3][3];
+    r[0][0] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+    r[0][1] = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+    r[0][2] = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+    r[1][0] = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+    r[1][1] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+    r[1][2] = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+    r[2][0] = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+    r[2][1] = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+    r[2][2] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+    __m128 inv_s[3];
+    for (uint32_t k = 0; k < 3; ++k) {
+      // (division by zero lanes is masked off afterwards)
+      inv_s[k] = _mm_and_ps(_mm_cmpneq_ps(s[k], zero), _mm_div_ps(one, s[k]));
+    }
+
+    __m128 l[4][3], li[4][3];
+    for (uint32_t c = 0; c < 3; ++c) {
+      for (uint32_t k = 0; k < 3; ++k) {
+        l[c][k] = _mm_mul_ps(r[c][k], s[c]);
+        li[c][k] = _mm_mul_ps(r[k][c], inv_s[k]);
+      }
+    }
+    l[3][0] = px;
+    l[3][1] = py;
+    l[3][2] = pz;
+    for (uint32_t k = 0; k < 3; ++k) {
+      __m128 d = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(r[k][0], px), _mm_mul_ps(r[k][1], py)),
+          _mm_mul_ps(r[k][2], pz));
+      li[3][k] = _mm_xor_ps(sign, _mm_mul_ps(inv_s[k], d));
+    }
+
+    for (uint32_t c = 0; c < 4; ++c) {
+      __m128 w[4], wi[4];
+      for (uint32_t k = 0; k < 3; ++k) {
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pw[0][k], l[c][0]),
+                                         _mm_mul_ps(pw[1][k], l[c][1])),
+                              _mm_mul_ps(pw[2][k], l[c][2]));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(li[0][k], pi[c][0]),
+                                         _mm_mul_ps(li[1][k], pi[c][1])),
+                              _mm_mul_ps(li[2][k], pi[c][2]));
+        if (c == 3) {
+          a = _mm_add_ps(a, pw[3][k]);
+          b = _mm_add_ps(b, li[3][k]);
+        }
+        w[k] = a;
+        wi[k] = b;
+      }
+      w[3] = wi[3] = (c == 3 ? one : zero);
+      // back to one column per job:
+      _MM_TRANSPOSE4_PS(w[0], w[1], w[2], w[3]);
+      _MM_TRANSPOSE4_PS(wi[0], wi[1], wi[2], wi[3]);
+      for (uint32_t i = 0; i < 4; ++i) {
+        _mm_storeu_ps(&(*g[i]->local_to_world)[c][0], w[i]);
+        _mm_storeu_ps(&(*g[i]->world_to_local)[c][0], wi[i]);
+      }
+    }
+  }
+}
+
+#else  // TRANSFORM_KERNELS_SSE
+
+void update_world_matrices(WorldMatrixJob const *jobs, uint32_t count) {
+  update_world_matrices_scalar(jobs, count);
+}
+
+#endif  // TRANSFORM_KERNELS_SSE
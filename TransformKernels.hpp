@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+
+// Bulk evaluation of transform hierarchies:
+//  each job composes a transform's local (translate * rotate * scale) matrix
+//  and its inverse, then multiplies them with its parent's world matrices.
+//  All the matrices involved are affine, so only their top three rows are
+//  computed (the bottom row is always 0 0 0 1).
+// update_world_matrices() works on four jobs at a time with SSE, gathering
+// them into structure-of-arrays form in registers; it does exactly the same
+// float operations, in the same order, as the scalar reference, so the two
+// give bit-identical results.
+
+struct WorldMatrixJob {
+  // the transform's local specification:
+  glm::vec3 const *position;
+  glm::quat const *rotation;  // (assumed to be unit length)
+  glm::vec3 const *scale;
+  // its parent's world matrices (both null for a root):
+  glm::mat4 const *parent_local_to_world;
+  glm::mat4 const *parent_world_to_local;
+  // where to write its own:
+  glm::mat4 *local_to_world;
+  glm::mat4 *world_to_local;
+};
+
+// runs jobs[0, count); no job's parent may be written by another job in the
+// same call (e.g. pass one level of the hierarchy at a time):
+void update_world_matrices(WorldMatrixJob const *jobs, uint32_t count);
+
+// the scalar reference (also used where SSE isn't available):
+void update_world_matrices_scalar(WorldMatrixJob const *jobs, uint32_t count);
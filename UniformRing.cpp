@@ -0,0 +1,105 @@
+#include "UniformRing.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+PFNGLBUFFERSTORAGEPROC uniform_ring_buffer_storage = nullptr;
+
+UniformRing::UniformRing(GLuint binding_, GLsizeiptr entry_size_) : binding(binding_), entry_size(entry_size_) {
+  std::fill(fences, fences + Segments, nullptr);
+}
+
+UniformRing::~UniformRing() {
+  release();
+}
+
+void UniformRing::release() {
+  for (GLsync &fence : fences) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+  if (buffer != 0) {
+    if (mapped) {
+      glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+      glUnmapBuffer(GL_UNIFORM_BUFFER);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      mapped = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+  }
+  capacity = 0;
+}
+
+void UniformRing::reallocate(uint32_t min_capacity) {
+  if (stride == 0) {
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 16);
+    stride = (entry_size + alignment - 1) / alignment * alignment;
+  }
+
+  //grow geometrically, so a slowly growing scene doesn't reallocate every frame:
+  uint32_t new_capacity = std::max(std::max(min_capacity, 2 * capacity), 64U);
+  release(); //(OpenGL keeps the old storage alive until draws already issued are done with it)
+  capacity = new_capacity;
+
+  GLsizeiptr size = GLsizeiptr(Segments) * capacity * stride;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  if (uniform_ring_buffer_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    uniform_ring_buffer_storage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+    mapped = reinterpret_cast< uint8_t * >(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+    if (!mapped) {
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      throw std::runtime_error("Failed to persistently map uniform ring buffer.");
+    }
+    staging.clear();
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    staging.resize(size_t(capacity) * stride);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+uint8_t *UniformRing::begin(uint32_t count_) {
+  count = count_;
+  if (buffer == 0 || count > capacity) {
+    reallocate(count);
+    segment = 0;
+  } else {
+    segment = (segment + 1) % Segments;
+  }
+
+  if (!mapped) return staging.data();
+
+  //wait (if needed) until the GPU has finished the draws that last read this segment:
+  GLsync &fence = fences[segment];
+  if (fence) {
+    while (true) {
+      GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+      if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+      if (result == GL_WAIT_FAILED) throw std::runtime_error("Failed to wait on uniform ring fence.");
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  return mapped + segment_offset();
+}
+
+void UniformRing::upload() {
+  if (mapped || count == 0) return; //(coherent mappings need no flush)
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, segment_offset(), GLsizeiptr(count) * stride, staging.data());
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRing::bind(uint32_t index) {
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, segment_offset() + GLintptr(index) * stride, entry_size);
+}
+
+void UniformRing::end() {
+  if (!mapped) return;
+  fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
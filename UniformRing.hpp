@@ -0,0 +1,53 @@
+#pragma once
+
+#include "GL.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//"UniformRing" streams a frame's worth of same-sized uniform blocks (e.g. per-object matrices) through one uniform buffer:
+// each frame, begin() hands out plain memory for the frame's entries (so any thread can fill them),
+// upload() hands them to OpenGL, bind() selects one entry for the next draw, and end() goes after the frame's draws.
+//The buffer is split into Segments used in turn, so entries for this frame are written while earlier frames may still be drawing:
+// - if uniform_ring_buffer_storage is set (ARB_buffer_storage), the buffer is persistently mapped and entries are written
+//   straight into it; a fence per segment keeps a segment from being rewritten before the GPU is done with it.
+// - otherwise (plain GL 3.3) entries are staged in memory and copied over with one glBufferSubData per frame.
+//OpenGL objects are made on the first begin(), so rings can be constructed (and destroyed unused) without a context.
+
+//glBufferStorage, if the context supports it (main looks it up after creating the context); null means use glBufferSubData:
+extern PFNGLBUFFERSTORAGEPROC uniform_ring_buffer_storage;
+
+struct UniformRing {
+  //entries are 'entry_size' bytes, bound at uniform buffer binding point 'binding':
+  UniformRing(GLuint binding, GLsizeiptr entry_size);
+  ~UniformRing();
+  UniformRing(UniformRing const &) = delete;
+  UniformRing &operator=(UniformRing const &) = delete;
+
+  //start a frame of 'count' entries; entry i goes at the returned pointer + i * stride:
+  //(the memory is only valid until upload(); it may be write-combined, so write it in order and never read it back)
+  uint8_t *begin(uint32_t count);
+  //make the entries written since begin() visible to OpenGL (call from the thread with the context):
+  void upload();
+  //bind entry 'index' of this frame:
+  void bind(uint32_t index);
+  //call after the frame's last draw that uses the ring:
+  void end();
+
+  GLuint binding;
+  GLsizeiptr entry_size;
+  GLsizeiptr stride = 0; //entry_size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT (known after the first begin())
+
+  //------ internals ------
+  static constexpr uint32_t Segments = 3;
+  GLuint buffer = 0;
+  uint32_t capacity = 0; //entries per segment
+  uint32_t segment = 0; //segment used by the current frame
+  uint32_t count = 0; //entries in the current frame
+  uint8_t *mapped = nullptr; //the whole buffer, when persistently mapped
+  GLsync fences[Segments]; //when persistently mapped: signaled once the GPU is done with each segment (or null)
+  std::vector< uint8_t > staging; //otherwise: the current frame's entries
+  GLintptr segment_offset() const { return GLintptr(segment) * capacity * stride; }
+  void reallocate(uint32_t min_capacity); //(re)create the buffer with room for at least min_capacity entries per segment
+  void release(); //delete the buffer (and fences)
+};
@@ -0,0 +1,301 @@
+#include "WalkClusters.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+// Cluster files start with a "wclu" chunk holding the format version, the
+// number of triangles in the walk mesh they were built for, the number of
+// clusters, and a checksum of that mesh (see mesh_checksum()):
+static const uint32_t ClustersVersion = 2;
+
+// FNV-1a over the bytes of the mesh's vertices and triangles, so clusters
+// built for an edited mesh with the same triangle count are noticed too:
+static uint32_t mesh_checksum(WalkMesh const &walk_mesh) {
+  uint32_t hash = 2166136261U;
+  auto add = [&hash](void const *data, size_t size) {
+    uint8_t const *bytes = reinterpret_cast<uint8_t const *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 16777619U;
+    }
+  };
+  add(walk_mesh.vertices.data(),
+      walk_mesh.vertices.size() * sizeof(glm::vec3));
+  add(walk_mesh.triangles.data(),
+      walk_mesh.triangles.size() * sizeof(glm::uvec3));
+  return hash;
+}
+
+// Dijkstra over the triangles of one cluster, starting from 'point' in
+// triangle 'start'; distances are measured between triangle centroids (as
+// WalkPathfinder does), and from 'point' for the start triangle:
+static void flood_cluster(WalkMesh const &walk_mesh,
+                          std::vector<uint32_t> const &triangle_clusters,
+                          std::vector<glm::vec3> const &centroids,
+                          uint32_t start, glm::vec3 const &point,
+                          std::vector<float> *cost_,
+                          std::vector<uint32_t> *came_from_) {
+  auto &cost = *cost_;
+  auto &came_from = *came_from_;
+  uint32_t cluster = triangle_clusters[start];
+
+  auto position = [&](uint32_t t) {
+    return (t == start ? point : centroids[t]);
+  };
+
+  std::priority_queue<std::pair<float, uint32_t>,
+                      std::vector<std::pair<float, uint32_t>>,
+                      std::greater<std::pair<float, uint32_t>>>
+      open;
+  cost[start] = 0.0f;
+  came_from[start] = -1U;
+  open.emplace(0.0f, start);
+  while (!open.empty()) {
+    float at_cost = open.top().first;
+    uint32_t at = open.top().second;
+    open.pop();
+    if (at_cost > cost[at]) continue;
+
+    glm::uvec3 const &next = walk_mesh.neighbors[at];
+    for (uint32_t i = 0; i < 3; ++i) {
+      uint32_t n = next[i];
+      if (n == -1U || triangle_clusters[n] != cluster) continue;
+      float n_cost = at_cost + glm::distance(position(at), centroids[n]);
+      if (n_cost >= cost[n]) continue;
+      cost[n] = n_cost;
+      came_from[n] = at;
+      open.emplace(n_cost, n);
+    }
+  }
+}
+
+WalkClusters::WalkClusters(WalkMesh const &walk_mesh, uint32_t cluster_size)
+    : walk_mesh_checksum(mesh_checksum(walk_mesh)),
+      walk_mesh_revision(walk_mesh.revision) {
+  uint32_t count = uint32_t(walk_mesh.triangles.size());
+  cluster_size = std::max(1U, cluster_size);
+
+  // grow clusters breadth-first; seeds are taken in bvh order, so clusters
+  // that get cut short by their neighbors still end up compact. The bvh only
+  // lists the triangles the mesh was built with, so pieces added by carving
+  // that no cluster reached seed clusters of their own afterward (and
+  // triangles carved away entirely share one last cluster, with no portals):
+  triangle_clusters.assign(count, -1U);
+  std::vector<std::vector<uint32_t>> members;
+  auto grow = [&](uint32_t seed) {
+    if (triangle_clusters[seed] != -1U || walk_mesh.removed(seed)) return;
+    members.emplace_back();
+    auto &queue = members.back();
+    queue.emplace_back(seed);
+    triangle_clusters[seed] = cluster_count;
+    for (uint32_t q = 0; q < queue.size(); ++q) {
+      glm::uvec3 const &next = walk_mesh.neighbors[queue[q]];
+      for (uint32_t i = 0; i < 3 && queue.size() < cluster_size; ++i) {
+        uint32_t n = next[i];
+        if (n == -1U || triangle_clusters[n] != -1U) continue;
+        triangle_clusters[n] = cluster_count;
+        queue.emplace_back(n);
+      }
+    }
+    ++cluster_count;
+  };
+  for (uint32_t seed : walk_mesh.bvh_triangles) grow(seed);
+  for (uint32_t seed = 0; seed < count; ++seed) grow(seed);
+  for (uint32_t t = 0; t < count; ++t) {
+    if (triangle_clusters[t] != -1U) continue;
+    if (members.size() == cluster_count) members.emplace_back();
+    members.back().emplace_back(t);
+    triangle_clusters[t] = cluster_count;
+  }
+  if (members.size() > cluster_count) ++cluster_count;
+
+  // every edge between two clusters is a portal:
+  std::vector<std::vector<uint32_t>> around(cluster_count);
+  for (uint32_t t = 0; t < count; ++t) {
+    glm::uvec3 const &tri = walk_mesh.triangles[t];
+    glm::uvec3 const &next = walk_mesh.neighbors[t];
+    for (uint32_t i = 0; i < 3; ++i) {
+      uint32_t n = next[i];
+      if (n == -1U || n < t) continue;
+      if (triangle_clusters[n] == triangle_clusters[t]) continue;
+      uint32_t p = uint32_t(portal_triangles.size());
+      portal_triangles.emplace_back(t, n);
+      portal_midpoints.emplace_back(0.5f *
+                                    (walk_mesh.vertices[tri[(i + 1) % 3]] +
+                                     walk_mesh.vertices[tri[(i + 2) % 3]]));
+      around[triangle_clusters[t]].emplace_back(p);
+      around[triangle_clusters[n]].emplace_back(p);
+    }
+  }
+  cluster_portal_offsets.emplace_back(0);
+  for (auto const &portals : around) {
+    cluster_portals.insert(cluster_portals.end(), portals.begin(),
+                           portals.end());
+    cluster_portal_offsets.emplace_back(uint32_t(cluster_portals.size()));
+  }
+
+  // link every pair of portals around each cluster:
+  std::vector<glm::vec3> centroids(count);
+  for (uint32_t t = 0; t < count; ++t) {
+    glm::uvec3 const &tri = walk_mesh.triangles[t];
+    centroids[t] = (walk_mesh.vertices[tri.x] + walk_mesh.vertices[tri.y] +
+                    walk_mesh.vertices[tri.z]) /
+                   3.0f;
+  }
+  std::vector<float> cost(count);
+  std::vector<uint32_t> came_from(count);
+  std::vector<std::vector<Link>> portal_links(portal_triangles.size());
+  std::vector<uint32_t> corridor;
+
+  for (uint32_t c = 0; c < cluster_count; ++c) {
+    for (uint32_t const &p : around[c]) {
+      uint32_t from = portal_side(p, c);
+      // (the flood only touches triangles in this cluster)
+      for (uint32_t t : members[c]) {
+        cost[t] = std::numeric_limits<float>::infinity();
+      }
+      flood_cluster(walk_mesh, triangle_clusters, centroids, from,
+                    portal_midpoints[p], &cost, &came_from);
+
+      for (uint32_t const &q : around[c]) {
+        if (q == p) continue;
+        uint32_t to = portal_side(q, c);
+        if (cost[to] == std::numeric_limits<float>::infinity()) continue;
+
+        Link link;
+        link.portal = q;
+        link.cost = cost[to] + glm::distance((to == from ? portal_midpoints[p]
+                                                         : centroids[to]),
+                                             portal_midpoints[q]);
+        corridor.clear();
+        for (uint32_t t = to; t != -1U; t = came_from[t]) {
+          corridor.emplace_back(t);
+        }
+        link.corridor_first = uint32_t(link_corridors.size());
+        link.corridor_count = uint32_t(corridor.size());
+        link_corridors.insert(link_corridors.end(), corridor.rbegin(),
+                              corridor.rend());
+        portal_links[p].emplace_back(link);
+      }
+    }
+  }
+
+  link_offsets.emplace_back(0);
+  for (auto const &list : portal_links) {
+    links.insert(links.end(), list.begin(), list.end());
+    link_offsets.emplace_back(uint32_t(links.size()));
+  }
+}
+
+WalkClusters::WalkClusters(WalkMesh const &walk_mesh,
+                           std::string const &filename) {
+  MappedFile file(filename);
+  size_t offset = 0;
+
+  static_assert(sizeof(glm::uvec2) == 2 * 4, "uvec2 is packed.");
+  static_assert(sizeof(glm::vec3) == 3 * 4, "vec3 is packed.");
+
+  std::vector<uint32_t> header;
+  file.read_chunk(&offset, "wclu", &header);
+  if (header.size() != 4 || header[0] != ClustersVersion) {
+    throw std::runtime_error("Walk clusters '" + filename +
+                             "' were built with a different format version.");
+  }
+  walk_mesh_checksum = mesh_checksum(walk_mesh);
+  walk_mesh_revision = walk_mesh.revision;
+  if (header[1] != walk_mesh.triangles.size() ||
+      header[3] != walk_mesh_checksum) {
+    throw std::runtime_error("Walk clusters '" + filename +
+                             "' were built for a different walk mesh.");
+  }
+  cluster_count = header[2];
+  file.read_chunk(&offset, "clt0", &triangle_clusters);
+  file.read_chunk(&offset, "clp0", &portal_triangles);
+  file.read_chunk(&offset, "clm0", &portal_midpoints);
+  file.read_chunk(&offset, "clo0", &cluster_portal_offsets);
+  file.read_chunk(&offset, "clc0", &cluster_portals);
+  file.read_chunk(&offset, "llo0", &link_offsets);
+  file.read_chunk(&offset, "lnk0", &links);
+  file.read_chunk(&offset, "lnc0", &link_corridors);
+
+  if (triangle_clusters.size() != walk_mesh.triangles.size() ||
+      portal_midpoints.size() != portal_triangles.size() ||
+      cluster_portal_offsets.size() != uint64_t(cluster_count) + 1 ||
+      link_offsets.size() != portal_triangles.size() + 1) {
+    throw std::runtime_error("Walk clusters '" + filename +
+                             "' have mismatched chunk sizes.");
+  }
+
+  // WalkPathfinder indexes with all of these unchecked, so make sure a
+  // damaged file can't point outside the arrays:
+  auto bad_index = [&filename](char const *what) {
+    return std::runtime_error("Walk clusters '" + filename + "' have " +
+                              what + ".");
+  };
+  uint32_t triangle_count = uint32_t(walk_mesh.triangles.size());
+  uint32_t portal_count = uint32_t(portal_triangles.size());
+  for (uint32_t c : triangle_clusters) {
+    if (c >= cluster_count) throw bad_index("an out-of-range cluster");
+  }
+  for (glm::uvec2 const &sides : portal_triangles) {
+    if (sides.x >= triangle_count || sides.y >= triangle_count) {
+      throw bad_index("an out-of-range portal triangle");
+    }
+    if (triangle_clusters[sides.x] == triangle_clusters[sides.y]) {
+      throw bad_index("a portal inside a cluster");
+    }
+  }
+  // (offsets must run from 0 to the end of the array they index, in order)
+  auto good_offsets = [](std::vector<uint32_t> const &offsets, size_t end) {
+    if (offsets.front() != 0 || offsets.back() != end) return false;
+    for (uint32_t i = 0; i + 1 < offsets.size(); ++i) {
+      if (offsets[i] > offsets[i + 1]) return false;
+    }
+    return true;
+  };
+  if (!good_offsets(cluster_portal_offsets, cluster_portals.size())) {
+    throw bad_index("bad cluster portal offsets");
+  }
+  for (uint32_t p : cluster_portals) {
+    if (p >= portal_count) throw bad_index("an out-of-range cluster portal");
+  }
+  if (!good_offsets(link_offsets, links.size())) {
+    throw bad_index("bad link offsets");
+  }
+  for (Link const &link : links) {
+    if (link.portal >= portal_count) {
+      throw bad_index("an out-of-range link portal");
+    }
+    if (uint64_t(link.corridor_first) + link.corridor_count >
+        link_corridors.size()) {
+      throw bad_index("an out-of-range link corridor");
+    }
+  }
+  for (uint32_t t : link_corridors) {
+    if (t >= triangle_count) throw bad_index("an out-of-range corridor");
+  }
+
+  if (offset != file.size) {
+    std::cerr << "WARNING: trailing data in walk clusters file '" << filename
+              << "'" << std::endl;
+  }
+}
+
+void WalkClusters::save(std::string const &filename) const {
+  std::ofstream file(filename, std::ios::binary);
+
+  write_chunk(file, "wclu",
+              std::vector<uint32_t>{ClustersVersion,
+                                    uint32_t(triangle_clusters.size()),
+                                    cluster_count, walk_mesh_checksum});
+  write_chunk(file, "clt0", triangle_clusters);
+  write_chunk(file, "clp0", portal_triangles);
+  write_chunk(file, "clm0", portal_midpoints);
+  write_chunk(file, "clo0", cluster_portal_offsets);
+  write_chunk(file, "clc0", cluster_portals);
+  write_chunk(file, "llo0", link_offsets);
+  write_chunk(file, "lnk0", links);
+  write_chunk(file, "lnc0", link_corridors);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <string>
+#include <vector>
+
+// "WalkClusters" is the coarse layer for hierarchical pathfinding on large
+// walk meshes:
+//  triangles are grouped into connected clusters, the mesh edges between
+//  clusters become portals, and the cost (and triangle corridor) of walking
+//  between every pair of portals around a cluster is precomputed.
+//  WalkPathfinder then searches the portal graph for long routes, and only
+//  searches triangles inside the start and goal clusters.
+// Building is meant to happen offline (see bake-walk-mesh); the result is
+// saved in a file next to the walk mesh blob and loaded with the mesh.
+
+struct WalkClusters {
+  // build clusters of about 'cluster_size' triangles for a walk mesh (which
+  // may have been carved):
+  WalkClusters(WalkMesh const &walk_mesh, uint32_t cluster_size);
+
+  // load clusters written by save():
+  // note: will throw if the file fails to read or was built for another mesh.
+  WalkClusters(WalkMesh const &walk_mesh, std::string const &filename);
+
+  void save(std::string const &filename) const;
+
+  // checksum of the walk mesh's vertices and triangles, saved with the
+  // clusters so loading them for a different mesh fails:
+  uint32_t walk_mesh_checksum = 0;
+  // the walk mesh's revision when the clusters were made; carving the mesh
+  // makes them stale (see WalkPathfinder::set_clusters):
+  uint32_t walk_mesh_revision = 0;
+
+  uint32_t cluster_count = 0;
+  std::vector<uint32_t> triangle_clusters;  // cluster of each triangle
+
+  // portals are mesh edges between two clusters:
+  //  portal_triangles[p] are the triangles on either side of the edge
+  std::vector<glm::uvec2> portal_triangles;
+  std::vector<glm::vec3> portal_midpoints;
+
+  // portals around cluster c are
+  //  cluster_portals[cluster_portal_offsets[c], cluster_portal_offsets[c+1])
+  std::vector<uint32_t> cluster_portal_offsets;
+  std::vector<uint32_t> cluster_portals;
+
+  // links join portals that share a cluster; links of portal p are
+  //  links[link_offsets[p], link_offsets[p+1]), and the corridor of a link
+  //  runs from p's triangle to 'portal''s triangle inside the shared cluster
+  struct Link {
+    uint32_t portal = -1U;  // portal at the other end
+    float cost = 0.0f;      // walking distance, measured like WalkPathfinder
+    uint32_t corridor_first = 0;  // in link_corridors
+    uint32_t corridor_count = 0;
+  };
+  static_assert(sizeof(Link) == 16, "Link is packed.");
+  std::vector<uint32_t> link_offsets;
+  std::vector<Link> links;
+  std::vector<uint32_t> link_corridors;
+
+  // the triangle of portal p that lies in cluster c:
+  uint32_t portal_side(uint32_t p, uint32_t c) const {
+    glm::uvec2 const &sides = portal_triangles[p];
+    return (triangle_clusters[sides.x] == c ? sides.x : sides.y);
+  }
+};
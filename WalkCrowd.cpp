@@ -0,0 +1,322 @@
+#include "WalkCrowd.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// agents are handed to threads this many at a time:
+static const uint32_t Chunk = 256;
+
+static float det(glm::vec2 const &a, glm::vec2 const &b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+WalkCrowd::WalkCrowd(WalkMesh const &walk_mesh_, uint32_t threads)
+    : walk_mesh(walk_mesh_), pool(threads) {
+  scratch.resize(pool.size());
+}
+
+uint32_t WalkCrowd::add(glm::vec3 const &position, float radius,
+                        float max_speed) {
+  uint32_t index = uint32_t(walk_points.size());
+  walk_points.emplace_back(walk_mesh.start(position));
+  positions.emplace_back(walk_mesh.world_point(walk_points.back()));
+  velocities.emplace_back(0.0f);
+  preferred_velocities.emplace_back(0.0f);
+  radii.emplace_back(radius);
+  max_speeds.emplace_back(max_speed);
+  return index;
+}
+
+void WalkCrowd::update(float elapsed) {
+  if (!(elapsed > 0.0f)) return;
+  uint32_t count = uint32_t(walk_points.size());
+
+  build_hash();
+
+  new_velocities.resize(count);
+  pool.run(count, Chunk,
+           [this, elapsed](uint32_t begin, uint32_t end, uint32_t thread) {
+             for (uint32_t i = begin; i < end; ++i) {
+               avoid(i, elapsed, scratch[thread]);
+             }
+           });
+
+  pool.run(count, Chunk, [this, elapsed](uint32_t begin, uint32_t end,
+                                         uint32_t) {
+    for (uint32_t i = begin; i < end; ++i) {
+      velocities[i] = new_velocities[i];
+      walk_mesh.walk(walk_points[i], glm::vec3(velocities[i], 0.0f) * elapsed);
+      positions[i] = walk_mesh.world_point(walk_points[i]);
+    }
+  });
+}
+
+//------------------------------------------------------------------
+
+glm::ivec3 WalkCrowd::cell_of(glm::vec3 const &position) const {
+  return glm::ivec3(glm::floor(position / neighbor_distance));
+}
+
+uint32_t WalkCrowd::bucket_of(glm::ivec3 const &cell) const {
+  // (the usual large-prime spatial hash; the table size is a power of two)
+  uint32_t hash = (uint32_t(cell.x) * 73856093U) ^
+                  (uint32_t(cell.y) * 19349663U) ^
+                  (uint32_t(cell.z) * 83492791U);
+  return hash & uint32_t(cell_starts.size() - 2);
+}
+
+void WalkCrowd::build_hash() {
+  uint32_t count = uint32_t(positions.size());
+
+  uint32_t buckets = 1;
+  while (buckets < 2 * count) buckets *= 2;
+  cell_starts.assign(buckets + 1, 0);
+
+  // counting sort of agents by bucket; after counting and summing,
+  // cell_starts[b] is the end of bucket b, and placing agents walks it back to
+  // the start:
+  agent_buckets.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    agent_buckets[i] = bucket_of(cell_of(positions[i]));
+    cell_starts[agent_buckets[i]] += 1;
+  }
+  for (uint32_t b = 1; b <= buckets; ++b) cell_starts[b] += cell_starts[b - 1];
+  cell_agents.resize(count);
+  for (uint32_t i = count; i > 0; --i) {
+    cell_agents[--cell_starts[agent_buckets[i - 1]]] = i - 1;
+  }
+}
+
+//------------------------------------------------------------------
+// The linear programs below find the velocity nearest 'preferred' (or
+// furthest along it, if 'direction' is set) inside a circle of radius
+// 'max_speed' that satisfies every half-plane. This is the standard ORCA
+// solver, from van den Berg et al., "Reciprocal n-Body Collision Avoidance".
+
+// solves on line 'index', subject to lines [0, index):
+static bool linear_program_1(std::vector<WalkCrowd::Line> const &lines,
+                             uint32_t index, float max_speed,
+                             glm::vec2 const &preferred, bool direction,
+                             glm::vec2 *result) {
+  WalkCrowd::Line const &line = lines[index];
+  float dot = glm::dot(line.point, line.direction);
+  float discriminant =
+      dot * dot + max_speed * max_speed - glm::dot(line.point, line.point);
+  if (discriminant < 0.0f) return false;  // the circle misses the line
+
+  float root = std::sqrt(discriminant);
+  float t_left = -dot - root;
+  float t_right = -dot + root;
+
+  for (uint32_t i = 0; i < index; ++i) {
+    float denominator = det(line.direction, lines[i].direction);
+    float numerator = det(lines[i].direction, line.point - lines[i].point);
+    if (std::abs(denominator) <= 1e-5f) {
+      // parallel lines; either all of this line is allowed or none of it is
+      if (numerator < 0.0f) return false;
+      continue;
+    }
+    float t = numerator / denominator;
+    if (denominator >= 0.0f) {
+      t_right = std::min(t_right, t);
+    } else {
+      t_left = std::max(t_left, t);
+    }
+    if (t_left > t_right) return false;
+  }
+
+  float t;
+  if (direction) {
+    t = (glm::dot(preferred, line.direction) > 0.0f ? t_right : t_left);
+  } else {
+    t = glm::clamp(glm::dot(line.direction, preferred - line.point), t_left,
+                   t_right);
+  }
+  *result = line.point + t * line.direction;
+  return true;
+}
+
+// returns the number of lines satisfied before failing (lines.size() if all
+// of them were):
+static uint32_t linear_program_2(std::vector<WalkCrowd::Line> const &lines,
+                                 float max_speed, glm::vec2 const &preferred,
+                                 bool direction, glm::vec2 *result) {
+  if (direction) {
+    *result = preferred * max_speed;  // ('preferred' is a unit vector here)
+  } else if (glm::dot(preferred, preferred) > max_speed * max_speed) {
+    *result = glm::normalize(preferred) * max_speed;
+  } else {
+    *result = preferred;
+  }
+
+  for (uint32_t i = 0; i < lines.size(); ++i) {
+    if (det(lines[i].direction, lines[i].point - *result) > 0.0f) {
+      // the result breaks this constraint; move it onto the line:
+      glm::vec2 before = *result;
+      if (!linear_program_1(lines, i, max_speed, preferred, direction,
+                            result)) {
+        *result = before;
+        return i;
+      }
+    }
+  }
+  return uint32_t(lines.size());
+}
+
+// when the constraints can't all be met, finds the velocity that breaks the
+// worst of them (from 'begin' on) the least:
+static void linear_program_3(std::vector<WalkCrowd::Line> const &lines,
+                             uint32_t begin, float max_speed,
+                             std::vector<WalkCrowd::Line> *projected_,
+                             glm::vec2 *result) {
+  auto &projected = *projected_;
+  float distance = 0.0f;
+
+  for (uint32_t i = begin; i < lines.size(); ++i) {
+    if (det(lines[i].direction, lines[i].point - *result) <= distance) {
+      continue;
+    }
+    projected.clear();
+    for (uint32_t j = 0; j < i; ++j) {
+      WalkCrowd::Line line;
+      float determinant = det(lines[i].direction, lines[j].direction);
+      if (std::abs(determinant) <= 1e-5f) {
+        if (glm::dot(lines[i].direction, lines[j].direction) > 0.0f) {
+          continue;  // same direction
+        }
+        line.point = 0.5f * (lines[i].point + lines[j].point);
+      } else {
+        line.point = lines[i].point +
+                     (det(lines[j].direction, lines[i].point - lines[j].point) /
+                      determinant) *
+                         lines[i].direction;
+      }
+      line.direction = glm::normalize(lines[j].direction - lines[i].direction);
+      projected.emplace_back(line);
+    }
+
+    glm::vec2 before = *result;
+    if (linear_program_2(projected, max_speed,
+                         glm::vec2(-lines[i].direction.y, lines[i].direction.x),
+                         true, result) < projected.size()) {
+      // (can only fail from rounding; keep the previous result)
+      *result = before;
+    }
+    distance = det(lines[i].direction, lines[i].point - *result);
+  }
+}
+
+//------------------------------------------------------------------
+
+void WalkCrowd::avoid(uint32_t agent, float elapsed, Scratch &scratch) {
+  glm::vec3 const &position = positions[agent];
+
+  // gather the nearest neighbors from the 27 cells around the agent, keeping
+  // the list sorted by distance:
+  auto &neighbors = scratch.neighbors;
+  neighbors.clear();
+  float range2 = neighbor_distance * neighbor_distance;
+  glm::ivec3 cell = cell_of(position);
+  uint32_t visited[27];
+  uint32_t visited_count = 0;
+  for (int32_t dz = -1; dz <= 1; ++dz) {
+    for (int32_t dy = -1; dy <= 1; ++dy) {
+      for (int32_t dx = -1; dx <= 1; ++dx) {
+        uint32_t bucket = bucket_of(cell + glm::ivec3(dx, dy, dz));
+        // (different cells can share a bucket; only visit it once)
+        if (std::find(visited, visited + visited_count, bucket) !=
+            visited + visited_count) {
+          continue;
+        }
+        visited[visited_count++] = bucket;
+
+        for (uint32_t c = cell_starts[bucket]; c < cell_starts[bucket + 1];
+             ++c) {
+          uint32_t other = cell_agents[c];
+          if (other == agent) continue;
+          float dis2 = glm::distance2(positions[other], position);
+          if (dis2 >= range2) continue;
+          if (neighbors.size() == max_neighbors) {
+            if (dis2 >= neighbors.back().first) continue;
+            neighbors.pop_back();
+          }
+          auto at = std::upper_bound(neighbors.begin(), neighbors.end(),
+                                     std::make_pair(dis2, other));
+          neighbors.insert(at, std::make_pair(dis2, other));
+        }
+      }
+    }
+  }
+
+  // one half-plane per neighbor; each agent takes half the responsibility
+  // for avoiding a collision:
+  auto &lines = scratch.lines;
+  lines.clear();
+  glm::vec2 at = glm::vec2(position);
+  glm::vec2 velocity = velocities[agent];
+  float inv_horizon = 1.0f / time_horizon;
+  for (auto const &neighbor : neighbors) {
+    uint32_t other = neighbor.second;
+    glm::vec2 relative_position = glm::vec2(positions[other]) - at;
+    glm::vec2 relative_velocity = velocity - velocities[other];
+    float dis2 = glm::dot(relative_position, relative_position);
+    float combined_radius = radii[agent] + radii[other];
+    float combined_radius2 = combined_radius * combined_radius;
+
+    Line line;
+    glm::vec2 u;
+    if (dis2 > combined_radius2) {
+      // not colliding yet; w points from the cut-off circle's center to the
+      // relative velocity:
+      glm::vec2 w = relative_velocity - inv_horizon * relative_position;
+      float w_length2 = glm::dot(w, w);
+      float dot = glm::dot(w, relative_position);
+      if (dot < 0.0f && dot * dot > combined_radius2 * w_length2) {
+        // project onto the cut-off circle:
+        float w_length = std::sqrt(w_length2);
+        glm::vec2 unit_w = w / w_length;
+        line.direction = glm::vec2(unit_w.y, -unit_w.x);
+        u = (combined_radius * inv_horizon - w_length) * unit_w;
+      } else {
+        // project onto a leg of the velocity obstacle:
+        float leg = std::sqrt(dis2 - combined_radius2);
+        if (det(relative_position, w) > 0.0f) {
+          line.direction = glm::vec2(relative_position.x * leg -
+                                         relative_position.y * combined_radius,
+                                     relative_position.x * combined_radius +
+                                         relative_position.y * leg) /
+                           dis2;
+        } else {
+          line.direction = -glm::vec2(relative_position.x * leg +
+                                          relative_position.y * combined_radius,
+                                      -relative_position.x * combined_radius +
+                                          relative_position.y * leg) /
+                           dis2;
+        }
+        u = glm::dot(relative_velocity, line.direction) * line.direction -
+            relative_velocity;
+      }
+    } else {
+      // already colliding; push apart within this tick:
+      float inv_elapsed = 1.0f / elapsed;
+      glm::vec2 w = relative_velocity - inv_elapsed * relative_position;
+      float w_length = glm::length(w);
+      glm::vec2 unit_w =
+          (w_length > 0.0f ? w / w_length : glm::vec2(1.0f, 0.0f));
+      line.direction = glm::vec2(unit_w.y, -unit_w.x);
+      u = (combined_radius * inv_elapsed - w_length) * unit_w;
+    }
+    line.point = velocity + 0.5f * u;
+    lines.emplace_back(line);
+  }
+
+  glm::vec2 result;
+  uint32_t failed = linear_program_2(lines, max_speeds[agent],
+                                     preferred_velocities[agent], false,
+                                     &result);
+  if (failed < lines.size()) {
+    linear_program_3(lines, failed, max_speeds[agent],
+                     &scratch.projected_lines, &result);
+  }
+  new_velocities[agent] = result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+#include "WorkerPool.hpp"
+
+#include <vector>
+
+// "WalkCrowd" moves many walkers over a WalkMesh without letting them pass
+// through each other:
+//  each tick, every agent's preferred velocity is adjusted to avoid its
+//  neighbors (optimal reciprocal collision avoidance, i.e. "ORCA" -- each
+//  neighbor rules out a half-plane of velocities, and the agent picks the
+//  allowed velocity nearest its preferred one), then the agent walks.
+// Neighbors are found through a spatial hash rebuilt every tick; the
+// avoidance and walking passes are split across a pool of worker threads.
+// Avoidance works in the xy (ground) plane; the walk mesh takes care of
+// height.
+
+struct WalkCrowd {
+  // threads == 0 picks one per hardware thread (the calling thread counts as
+  // one of them):
+  explicit WalkCrowd(WalkMesh const &walk_mesh, uint32_t threads = 0);
+  WalkCrowd(WalkCrowd const &) = delete;
+  WalkCrowd &operator=(WalkCrowd const &) = delete;
+
+  // adds an agent at (the walk mesh point closest to) 'position'; returns
+  // its index in the agent arrays:
+  uint32_t add(glm::vec3 const &position, float radius = 0.3f,
+               float max_speed = 1.5f);
+
+  // avoid, then walk every agent for 'elapsed' seconds:
+  void update(float elapsed);
+
+  WalkMesh const &walk_mesh;
+
+  // agents, stored as parallel arrays:
+  std::vector<WalkMesh::WalkPoint> walk_points;
+  std::vector<glm::vec3> positions;  // world-space (kept up to date by update)
+  std::vector<glm::vec2> velocities;
+  std::vector<glm::vec2> preferred_velocities;  // set by the game each tick
+  std::vector<float> radii;
+  std::vector<float> max_speeds;
+
+  // tuning:
+  float neighbor_distance = 3.0f;  // how far away neighbors are considered
+  uint32_t max_neighbors = 10;     // (the nearest ones are kept)
+  float time_horizon = 2.0f;  // how far ahead (in seconds) to avoid others
+
+  //------ internals ------
+
+  // spatial hash: agents sorted by cell, with the agents in hash bucket b at
+  //  cell_agents[cell_starts[b], cell_starts[b+1])
+  std::vector<uint32_t> agent_buckets;
+  std::vector<uint32_t> cell_starts;
+  std::vector<uint32_t> cell_agents;
+  void build_hash();
+  glm::ivec3 cell_of(glm::vec3 const &position) const;
+  uint32_t bucket_of(glm::ivec3 const &cell) const;
+
+  // an ORCA half-plane: allowed velocities are to the left of 'direction'
+  // through 'point':
+  struct Line {
+    glm::vec2 point;
+    glm::vec2 direction;
+  };
+  // per-thread scratch, so the avoidance pass doesn't allocate:
+  struct Scratch {
+    std::vector<std::pair<float, uint32_t>> neighbors;  // (distance², agent)
+    std::vector<Line> lines;
+    std::vector<Line> projected_lines;
+  };
+  std::vector<Scratch> scratch;
+
+  std::vector<glm::vec2> new_velocities;
+  void avoid(uint32_t agent, float elapsed, Scratch &scratch);
+
+  // the avoidance and walking passes are split across this:
+  WorkerPool pool;
+};
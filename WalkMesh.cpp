@@ -1,5 +1,17 @@
 #include "WalkMesh.hpp"
 
+#include "MappedFile.hpp"
+
+#include <cassert>
+#include <map>
+#include <tuple>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WALK_MESH_SSE 1
+#include <xmmintrin.h>
+#endif
+
 // adapted from here:
 // https://www.gamedev.net/forums/topic/552906-closest-point-on-triangle/
 static glm::vec3 closest_point_on_triangle(
@@ -74,169 +86,1545 @@ static glm::vec3 closest_point_on_triangle(
   return triangle[0] + s * edge0 + t * edge1;
 }
 
-// Compute barycentric coordinates (u, v, w) for
-// point p with respect to triangle (a, b, c)
-// adapted from
-// https://gamedev.stackexchange.com/questions/23743/whats-the-most-efficient-way-to-find-barycentric-coordinates
-static glm::vec3 barycentric(glm::vec3 p, glm::vec3 a, glm::vec3 b,
-                             glm::vec3 c) {
-  float u, v, w;
-  glm::vec3 v0 = b - a, v1 = c - a, v2 = p - a;
-  float d00 = glm::dot(v0, v0);
-  float d01 = glm::dot(v0, v1);
-  float d11 = glm::dot(v1, v1);
-  float d20 = glm::dot(v2, v0);
-  float d21 = glm::dot(v2, v1);
-  float denom = d00 * d11 - d01 * d01;
-  v = (d11 * d20 - d01 * d21) / denom;
-  w = (d00 * d21 - d01 * d20) / denom;
-  u = 1.0f - v - w;
-
-  return glm::vec3(u, v, w);
-}
+// Baked walk mesh files start with a "wmsh" chunk holding the format version,
+// followed by the source data and everything the constructor would otherwise
+// have to build (see WalkMesh::save):
+static const uint32_t BakedVersion = 2;
+// (BVH traversals keep a 64-entry stack, which holds one entry per level
+//  plus the two children of the deepest node; deeper baked bvhs are refused)
+static const uint32_t MaxBVHDepth = 62;
 
 WalkMesh::WalkMesh(std::string filename) {
-  std::ifstream file(filename, std::ios::binary);
+  MappedFile file(filename);
+  size_t offset = 0;
 
   static_assert(sizeof(glm::vec3) == 3 * 4, "vec3 is packed.");
   static_assert(sizeof(glm::uvec3) == 3 * 4, "uvec3 is packed.");
+  static_assert(sizeof(glm::u8vec3) == 3 * 1, "u8vec3 is packed.");
+
+  if (file.peek_magic(offset) == "wmsh") {
+    std::vector<uint32_t> version;
+    file.read_chunk(&offset, "wmsh", &version);
+    if (version.size() != 1 || version[0] != BakedVersion) {
+      throw std::runtime_error("Walk mesh '" + filename +
+                               "' was baked with a different format version.");
+    }
+    file.read_chunk(&offset, "vtx0", &vertices);
+    file.read_chunk(&offset, "tri0", &triangles);
+    file.read_chunk(&offset, "nom0", &vertex_normals);
+    file.read_chunk(&offset, "adj0", &neighbors);
+    file.read_chunk(&offset, "ade0", &neighbor_edges);
+    file.read_chunk(&offset, "grv0", &triangle_gradient_v);
+    file.read_chunk(&offset, "grw0", &triangle_gradient_w);
+    file.read_chunk(&offset, "fnm0", &triangle_normals);
+    file.read_chunk(&offset, "bvn0", &bvh_nodes);
+    file.read_chunk(&offset, "bvt0", &bvh_triangles);
+    std::vector<float> grid_placement;
+    file.read_chunk(&offset, "grd0", &grid_placement);
+    std::vector<uint32_t> grid_size;
+    file.read_chunk(&offset, "grn0", &grid_size);
+    file.read_chunk(&offset, "gro0", &grid_offsets);
+    file.read_chunk(&offset, "grt0", &grid_triangles);
+    // (only tiles have border flags)
+    if (file.peek_magic(offset) == "bdr0") {
+      file.read_chunk(&offset, "bdr0", &triangle_borders);
+    }
+
+    if (neighbors.size() != triangles.size() ||
+        neighbor_edges.size() != triangles.size() ||
+        triangle_gradient_v.size() != triangles.size() ||
+        triangle_gradient_w.size() != triangles.size() ||
+        triangle_normals.size() != triangles.size() ||
+        bvh_triangles.size() != triangles.size() ||
+        (!triangle_borders.empty() &&
+         triangle_borders.size() != triangles.size()) ||
+        grid_placement.size() != 3 || grid_size.size() != 2) {
+      throw std::runtime_error("Walk mesh '" + filename +
+                               "' has mismatched chunk sizes.");
+    }
+    grid_origin = glm::vec2(grid_placement[0], grid_placement[1]);
+    grid_cell_size = grid_placement[2];
+    grid_columns = grid_size[0];
+    grid_rows = grid_size[1];
 
-  read_chunk(file, "vtx0", &vertices);
-  read_chunk(file, "tri0", &triangles);
-  read_chunk(file, "nom0", &vertex_normals);
+    // indices are used without checks later, so make sure a damaged (or
+    // stale) file can't point outside the arrays:
+    auto bad_index = [&filename](char const *what) {
+      return std::runtime_error("Walk mesh '" + filename + "' has " + what +
+                                ".");
+    };
+    for (uint32_t t = 0; t < triangles.size(); ++t) {
+      for (uint32_t i = 0; i < 3; ++i) {
+        if (triangles[t][i] >= vertices.size()) {
+          throw bad_index("a triangle with an out-of-range vertex");
+        }
+        if (neighbors[t][i] != -1U && neighbors[t][i] >= triangles.size()) {
+          throw bad_index("an out-of-range neighbor");
+        }
+        if (neighbor_edges[t][i] >= 3) {
+          throw bad_index("an out-of-range neighbor edge");
+        }
+      }
+    }
+    for (uint32_t t : bvh_triangles) {
+      if (t >= triangles.size()) {
+        throw bad_index("an out-of-range bvh triangle");
+      }
+    }
+    if (bvh_nodes.empty() != triangles.empty()) {
+      throw bad_index("a bvh that doesn't match its triangles");
+    }
+    // (children always come after their parents, and traversal keeps a
+    //  fixed-size stack, so depth is limited too)
+    std::vector<uint32_t> depths(bvh_nodes.size(), 0);
+    for (uint32_t n = 0; n < bvh_nodes.size(); ++n) {
+      BVHNode const &node = bvh_nodes[n];
+      if (node.count == 0) {
+        if (node.first <= n || uint64_t(node.first) + 1 >= bvh_nodes.size()) {
+          throw bad_index("an out-of-range bvh child");
+        }
+        for (uint32_t c = node.first; c <= node.first + 1; ++c) {
+          depths[c] = std::max(depths[c], depths[n] + 1);
+        }
+        if (depths[node.first] >= MaxBVHDepth) {
+          throw bad_index("a bvh that is too deep");
+        }
+      } else if (uint64_t(node.first) + node.count > bvh_triangles.size()) {
+        throw bad_index("an out-of-range bvh leaf");
+      }
+    }
+    // (meshes that aren't mostly floor have no grid at all)
+    uint64_t cells = uint64_t(grid_columns) * grid_rows;
+    if (cells == 0) {
+      if (!grid_offsets.empty() || !grid_triangles.empty()) {
+        throw bad_index("a grid with no cells");
+      }
+    } else {
+      if (grid_offsets.size() != cells + 1 || !(grid_cell_size > 0.0f)) {
+        throw bad_index("a grid that doesn't match its size");
+      }
+      if (grid_offsets.front() != 0 ||
+          grid_offsets.back() != grid_triangles.size()) {
+        throw bad_index("out-of-range grid offsets");
+      }
+      for (uint32_t c = 0; c + 1 < grid_offsets.size(); ++c) {
+        if (grid_offsets[c] > grid_offsets[c + 1]) {
+          throw bad_index("out-of-order grid offsets");
+        }
+      }
+      for (uint32_t t : grid_triangles) {
+        if (t >= triangles.size()) {
+          throw bad_index("an out-of-range grid triangle");
+        }
+      }
+    }
+  } else {
+    // unbaked mesh (as written by export-walk-mesh.py); build the rest here:
+    file.read_chunk(&offset, "vtx0", &vertices);
+    file.read_chunk(&offset, "tri0", &triangles);
+    file.read_chunk(&offset, "nom0", &vertex_normals);
+
+    build_adjacency();
+    build_projection();
+    build_bvh();
+    build_grid();
+  }
+  if (vertex_normals.size() != vertices.size()) {
+    throw std::runtime_error("Walk mesh '" + filename +
+                             "' has mismatched normal and vertex counts.");
+  }
+
+  if (offset != file.size) {
+    std::cerr << "WARNING: trailing data in walk mesh file '" << filename
+              << "'" << std::endl;
+  }
 
   std::cout << vertices.size() << " number of vertices" << std::endl;
   std::cout << triangles.size() << " number of triangles" << std::endl;
+}
+
+WalkMesh::WalkMesh(std::vector<glm::vec3> const &vertices_,
+                   std::vector<glm::uvec3> const &triangles_,
+                   std::vector<glm::vec3> const &vertex_normals_)
+    : vertices(vertices_),
+      triangles(triangles_),
+      vertex_normals(vertex_normals_) {
+  build_adjacency();
+  build_projection();
+  build_bvh();
+  build_grid();
+}
+
+void WalkMesh::save(std::string const &filename) const {
+  // (pieces from carving aren't in the bvh, and baked files have no chains)
+  if (revision != 0) {
+    throw std::runtime_error("Can't save carved walk mesh '" + filename +
+                             "'.");
+  }
+  std::ofstream file(filename, std::ios::binary);
+
+  write_chunk(file, "wmsh", std::vector<uint32_t>(1, BakedVersion));
+  write_chunk(file, "vtx0", vertices);
+  write_chunk(file, "tri0", triangles);
+  write_chunk(file, "nom0", vertex_normals);
+  write_chunk(file, "adj0", neighbors);
+  write_chunk(file, "ade0", neighbor_edges);
+  write_chunk(file, "grv0", triangle_gradient_v);
+  write_chunk(file, "grw0", triangle_gradient_w);
+  write_chunk(file, "fnm0", triangle_normals);
+  write_chunk(file, "bvn0", bvh_nodes);
+  write_chunk(file, "bvt0", bvh_triangles);
+  write_chunk(file, "grd0",
+              std::vector<float>{grid_origin.x, grid_origin.y, grid_cell_size});
+  write_chunk(file, "grn0", std::vector<uint32_t>{grid_columns, grid_rows});
+  write_chunk(file, "gro0", grid_offsets);
+  write_chunk(file, "grt0", grid_triangles);
+  if (!triangle_borders.empty()) {
+    write_chunk(file, "bdr0", triangle_borders);
+  }
+}
+
+// Barycentric coordinates (u, v, w) of point p with respect to triangle
+// (a, b, c) are v = dot(p - a, gradient_v), w = dot(p - a, gradient_w),
+// u = 1 - v - w, where the gradients fold the inverse Gram matrix of the edge
+// vectors into the edges themselves.
+// adapted from
+// https://gamedev.stackexchange.com/questions/23743/whats-the-most-efficient-way-to-find-barycentric-coordinates
+void WalkMesh::build_projection() {
+  triangle_gradient_v.resize(triangles.size());
+  triangle_gradient_w.resize(triangles.size());
+  triangle_normals.resize(triangles.size());
+
+  for (uint32_t t = 0; t < triangles.size(); ++t) {
+    project_triangle(t);
+  }
+}
+
+void WalkMesh::project_triangle(uint32_t t) {
+  glm::uvec3 const &tri = triangles[t];
+  glm::vec3 v0 = vertices[tri[1]] - vertices[tri[0]];
+  glm::vec3 v1 = vertices[tri[2]] - vertices[tri[0]];
+  // (in double, since the denominator cancels badly for thin triangles, and
+  // carving makes some of those)
+  glm::dvec3 d0 = glm::dvec3(v0), d1 = glm::dvec3(v1);
+  double d00 = glm::dot(d0, d0);
+  double d01 = glm::dot(d0, d1);
+  double d11 = glm::dot(d1, d1);
+  double denom = d00 * d11 - d01 * d01;
+  glm::vec3 normal = glm::cross(v0, v1);
+
+  if (denom > 0.0 && normal != glm::vec3(0.0f)) {
+    triangle_gradient_v[t] = glm::vec3((d11 * d0 - d01 * d1) / denom);
+    triangle_gradient_w[t] = glm::vec3((d00 * d1 - d01 * d0) / denom);
+    triangle_normals[t] = glm::normalize(normal);
+  } else {  // degenerate triangle; points in it can't move
+    triangle_gradient_v[t] = glm::vec3(0.0f);
+    triangle_gradient_w[t] = glm::vec3(0.0f);
+    triangle_normals[t] = glm::vec3(0.0f, 0.0f, 1.0f);
+  }
+}
+
+void WalkMesh::build_adjacency() {
+  neighbors.assign(triangles.size(), glm::uvec3(-1U));
+  neighbor_edges.assign(triangles.size(), glm::u8vec3(0));
+
+  // edge i of triangle t is stored as t * 3 + i and runs from vertex (i+1)%3
+  // to vertex (i+2)%3:
+  auto edge_from = [this](uint32_t edge) {
+    return triangles[edge / 3][(edge % 3 + 1) % 3];
+  };
+  auto edge_to = [this](uint32_t edge) {
+    return triangles[edge / 3][(edge % 3 + 2) % 3];
+  };
+
+  // bucket every edge by its lower-numbered vertex (a counting sort), so
+  // matching edges only ever compares the handful of edges around one vertex:
+  std::vector<uint32_t> bucket_begin(vertices.size() + 1, 0);
+  for (auto const &tri : triangles) {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (tri[i] >= vertices.size()) {
+        throw std::runtime_error("walk mesh triangle has out-of-range vertex");
+      }
+    }
+    bucket_begin[std::min(tri.x, tri.y) + 1] += 1;
+    bucket_begin[std::min(tri.y, tri.z) + 1] += 1;
+    bucket_begin[std::min(tri.z, tri.x) + 1] += 1;
+  }
+  for (uint32_t v = 0; v < vertices.size(); ++v) {
+    bucket_begin[v + 1] += bucket_begin[v];
+  }
+
+  std::vector<uint32_t> edges(triangles.size() * 3);
+  std::vector<uint32_t> bucket_fill(bucket_begin.begin(),
+                                    bucket_begin.end() - 1);
+  for (uint32_t edge = 0; edge < edges.size(); ++edge) {
+    edges[bucket_fill[std::min(edge_from(edge), edge_to(edge))]++] = edge;
+  }
+
+  // triangles are CCW-oriented, so the triangle over edge [a,b] is the one
+  // that has edge [b,a]:
+  for (uint32_t v = 0; v < vertices.size(); ++v) {
+    for (uint32_t i = bucket_begin[v]; i < bucket_begin[v + 1]; ++i) {
+      uint32_t a = edges[i];
+      if (neighbors[a / 3][a % 3] != -1U) continue;
+      for (uint32_t j = i + 1; j < bucket_begin[v + 1]; ++j) {
+        uint32_t b = edges[j];
+        if (neighbors[b / 3][b % 3] != -1U) continue;
+        if (edge_from(a) == edge_to(b) && edge_to(a) == edge_from(b)) {
+          neighbors[a / 3][a % 3] = b / 3;
+          neighbor_edges[a / 3][a % 3] = uint8_t(b % 3);
+          neighbors[b / 3][b % 3] = a / 3;
+          neighbor_edges[b / 3][b % 3] = uint8_t(a % 3);
+          break;
+        }
+      }
+    }
+  }
+}
+
+// leaves of the bvh hold at most this many triangles:
+static const uint32_t BVHLeafSize = 4;
+
+void WalkMesh::build_bvh() {
+  bvh_nodes.clear();
+  bvh_triangles.resize(triangles.size());
+  for (uint32_t t = 0; t < triangles.size(); ++t) {
+    bvh_triangles[t] = t;
+  }
+  if (triangles.empty()) return;
+
+  std::vector<glm::vec3> centroids(triangles.size());
+  for (uint32_t t = 0; t < triangles.size(); ++t) {
+    glm::uvec3 const &tri = triangles[t];
+    centroids[t] =
+        (vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f;
+  }
+
+  bvh_nodes.reserve(2 * (triangles.size() / BVHLeafSize + 1));
+  bvh_nodes.emplace_back();
+  bvh_nodes[0].first = 0;
+  bvh_nodes[0].count = uint32_t(triangles.size());
 
-  for (auto const &triangle : triangles) {
-    next_vertex[glm::uvec2(triangle.x, triangle.y)] = triangle.z;
-    next_vertex[glm::uvec2(triangle.y, triangle.z)] = triangle.x;
-    next_vertex[glm::uvec2(triangle.z, triangle.x)] = triangle.y;
+  // split nodes (median of the longest centroid axis) until leaves are small:
+  std::vector<uint32_t> to_split(1, 0);
+  while (!to_split.empty()) {
+    uint32_t n = to_split.back();
+    to_split.pop_back();
+    uint32_t first = bvh_nodes[n].first;
+    uint32_t count = bvh_nodes[n].count;
+
+    glm::vec3 centroid_min(std::numeric_limits<float>::infinity());
+    glm::vec3 centroid_max(-std::numeric_limits<float>::infinity());
+    for (uint32_t i = first; i < first + count; ++i) {
+      glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+      for (uint32_t v = 0; v < 3; ++v) {
+        bvh_nodes[n].min = glm::min(bvh_nodes[n].min, vertices[tri[v]]);
+        bvh_nodes[n].max = glm::max(bvh_nodes[n].max, vertices[tri[v]]);
+      }
+      centroid_min = glm::min(centroid_min, centroids[bvh_triangles[i]]);
+      centroid_max = glm::max(centroid_max, centroids[bvh_triangles[i]]);
+    }
+
+    if (count <= BVHLeafSize) continue;
+    glm::vec3 extent = centroid_max - centroid_min;
+    uint32_t axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+    if (extent[axis] <= 0.0f) continue;  // all centroids coincide
+
+    uint32_t mid = first + count / 2;
+    std::nth_element(bvh_triangles.begin() + first,
+                     bvh_triangles.begin() + mid,
+                     bvh_triangles.begin() + first + count,
+                     [&](uint32_t a, uint32_t b) {
+                       return centroids[a][axis] < centroids[b][axis];
+                     });
+
+    uint32_t child = uint32_t(bvh_nodes.size());
+    bvh_nodes.emplace_back();
+    bvh_nodes.back().first = first;
+    bvh_nodes.back().count = mid - first;
+    bvh_nodes.emplace_back();
+    bvh_nodes.back().first = mid;
+    bvh_nodes.back().count = first + count - mid;
+    bvh_nodes[n].first = child;
+    bvh_nodes[n].count = 0;
+    to_split.emplace_back(child);
+    to_split.emplace_back(child + 1);
+  }
+}
+
+// the grid is only built if at least this much of the mesh's area is floor
+// (i.e., faces within about 45 degrees of straight up or down):
+static const float GridFloorFraction = 0.8f;
+static const float GridFloorNormalZ = 0.7f;
+
+void WalkMesh::build_grid() {
+  grid_offsets.clear();
+  grid_triangles.clear();
+  grid_columns = grid_rows = 0;
+  if (triangles.empty()) return;
+
+  float area = 0.0f, floor_area = 0.0f;
+  glm::vec2 min = glm::vec2(std::numeric_limits<float>::infinity());
+  glm::vec2 max = -min;
+  for (auto const &tri : triangles) {
+    glm::vec3 const &a = vertices[tri.x];
+    glm::vec3 const &b = vertices[tri.y];
+    glm::vec3 const &c = vertices[tri.z];
+    glm::vec3 cross = glm::cross(b - a, c - a);
+    float length = glm::length(cross);
+    area += length;
+    if (std::abs(cross.z) >= GridFloorNormalZ * length) floor_area += length;
+    min = glm::min(min, glm::min(glm::vec2(a), glm::min(glm::vec2(b),
+                                                        glm::vec2(c))));
+    max = glm::max(max, glm::max(glm::vec2(a), glm::max(glm::vec2(b),
+                                                        glm::vec2(c))));
+  }
+  if (!(floor_area >= GridFloorFraction * area)) return;
+
+  // about one triangle per cell:
+  glm::vec2 size = glm::max(max - min, glm::vec2(1e-4f));
+  grid_cell_size = std::sqrt(size.x * size.y / float(triangles.size()));
+  grid_cell_size = std::max(grid_cell_size,
+                            std::max(size.x, size.y) / float(triangles.size()));
+  grid_origin = min;
+  grid_columns = uint32_t(size.x / grid_cell_size) + 1;
+  grid_rows = uint32_t(size.y / grid_cell_size) + 1;
+
+  // triangles go in every cell their xy bounds overlap; count, then fill:
+  auto cells = [&](glm::uvec3 const &tri, glm::uvec2 *lo, glm::uvec2 *hi) {
+    glm::vec2 a = glm::vec2(vertices[tri.x]);
+    glm::vec2 b = glm::vec2(vertices[tri.y]);
+    glm::vec2 c = glm::vec2(vertices[tri.z]);
+    glm::vec2 tri_min = (glm::min(a, glm::min(b, c)) - grid_origin);
+    glm::vec2 tri_max = (glm::max(a, glm::max(b, c)) - grid_origin);
+    *lo = glm::uvec2(glm::max(tri_min / grid_cell_size, glm::vec2(0.0f)));
+    *hi = glm::min(glm::uvec2(tri_max / grid_cell_size),
+                   glm::uvec2(grid_columns - 1, grid_rows - 1));
+  };
+  grid_offsets.assign(grid_columns * grid_rows + 1, 0);
+  for (auto const &tri : triangles) {
+    glm::uvec2 lo, hi;
+    cells(tri, &lo, &hi);
+    for (uint32_t y = lo.y; y <= hi.y; ++y) {
+      for (uint32_t x = lo.x; x <= hi.x; ++x) {
+        grid_offsets[y * grid_columns + x + 1] += 1;
+      }
+    }
+  }
+  for (uint32_t c = 0; c + 1 < grid_offsets.size(); ++c) {
+    grid_offsets[c + 1] += grid_offsets[c];
+  }
+  grid_triangles.resize(grid_offsets.back());
+  std::vector<uint32_t> next(grid_offsets.begin(), grid_offsets.end() - 1);
+  for (uint32_t t = 0; t < triangles.size(); ++t) {
+    glm::uvec2 lo, hi;
+    cells(triangles[t], &lo, &hi);
+    for (uint32_t y = lo.y; y <= hi.y; ++y) {
+      for (uint32_t x = lo.x; x <= hi.x; ++x) {
+        grid_triangles[next[y * grid_columns + x]++] = t;
+      }
+    }
+  }
+}
+
+// squared distance from a point to an axis-aligned box (0 if inside):
+static float distance2_to_box(glm::vec3 const &pos, glm::vec3 const &min,
+                              glm::vec3 const &max) {
+  glm::vec3 outside = glm::max(glm::max(min - pos, pos - max), glm::vec3(0.0f));
+  return glm::dot(outside, outside);
+}
+
+// Offers triangle t as the closest so far:
+static void guess_closest(WalkMesh const &mesh, uint32_t t,
+                          glm::vec3 const &world_point,
+                          WalkMesh::WalkPoint *closest, float *closest_dist2) {
+  glm::uvec3 const &tri = mesh.triangles[t];
+  std::array<glm::vec3, 3> tri_verts = {{mesh.vertices[tri[0]],
+                                         mesh.vertices[tri[1]],
+                                         mesh.vertices[tri[2]]}};
+  glm::vec3 point = closest_point_on_triangle(tri_verts, world_point);
+  float dist2 = glm::distance2(point, world_point);
+  if (dist2 < *closest_dist2 ||
+      (dist2 == *closest_dist2 && t < closest->triangle)) {
+    *closest_dist2 = dist2;
+    closest->triangle = t;
+    // (rounding can leave a point on an edge a hair outside; walk() needs
+    //  the weights to be non-negative)
+    glm::vec3 weights = glm::max(mesh.barycentric(t, point), 0.0f);
+    closest->weights = weights / (weights.x + weights.y + weights.z);
+  }
+}
+
+// Updates 'closest' / 'closest_dist2' with any point of the mesh that is
+// nearer to 'world_point'. Subtrees that can't beat the current best are
+// skipped, so starting from a good guess makes the search cheaper. Ties go to
+// the lower triangle index (which is what a linear scan would return):
+static void find_closest(WalkMesh const &mesh, glm::vec3 const &world_point,
+                         WalkMesh::WalkPoint *closest, float *closest_dist2) {
+  if (mesh.bvh_nodes.empty()) return;
+
+  // the tree is balanced, so its depth is ~log2(triangles / BVHLeafSize):
+  uint32_t stack[64];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size) {
+    WalkMesh::BVHNode const &node = mesh.bvh_nodes[stack[--stack_size]];
+    if (distance2_to_box(world_point, node.min, node.max) > *closest_dist2) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      // visit the nearer child first by pushing it last:
+      WalkMesh::BVHNode const &a = mesh.bvh_nodes[node.first];
+      WalkMesh::BVHNode const &b = mesh.bvh_nodes[node.first + 1];
+      if (distance2_to_box(world_point, a.min, a.max) <
+          distance2_to_box(world_point, b.min, b.max)) {
+        stack[stack_size++] = node.first + 1;
+        stack[stack_size++] = node.first;
+      } else {
+        stack[stack_size++] = node.first;
+        stack[stack_size++] = node.first + 1;
+      }
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+      for (uint32_t t = mesh.bvh_triangles[i]; t != -1U;
+           t = mesh.next_piece(t)) {
+        if (mesh.removed(t)) continue;
+        guess_closest(mesh, t, world_point, closest, closest_dist2);
+      }
+    }
+  }
+}
+
+// how far (in barycentric coordinates) outside a triangle locate() accepts:
+static const float LocateSlack = 1e-3f;
+
+// Finds the triangle straight above or below 'world_point' (nearest in z)
+// among those in its grid cell; returns false if there isn't one:
+static bool locate_in_grid(WalkMesh const &mesh, glm::vec3 const &world_point,
+                           WalkMesh::WalkPoint *found) {
+  uint32_t cell = mesh.grid_cell(world_point);
+  if (cell == -1U) return false;
+
+  float found_height = std::numeric_limits<float>::infinity();
+  for (uint32_t i = mesh.grid_offsets[cell]; i < mesh.grid_offsets[cell + 1];
+       ++i) {
+    for (uint32_t t = mesh.grid_triangles[i]; t != -1U;
+         t = mesh.next_piece(t)) {
+      if (mesh.removed(t)) continue;
+      glm::uvec3 const &tri = mesh.triangles[t];
+      glm::vec3 const &a3 = mesh.vertices[tri.x];
+      glm::vec3 const &b3 = mesh.vertices[tri.y];
+      glm::vec3 const &c3 = mesh.vertices[tri.z];
+      glm::vec2 a = glm::vec2(a3), b = glm::vec2(b3), c = glm::vec2(c3);
+      glm::vec2 p = glm::vec2(world_point);
+
+      // barycentric coordinates of the point in the triangle's xy shadow:
+      float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+      if (area == 0.0f) continue;  // (a wall, seen from above)
+      float v = ((p.x - a.x) * (c.y - a.y) - (c.x - a.x) * (p.y - a.y)) / area;
+      float w = ((b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y)) / area;
+      // (a little slack, so points right on a boundary edge still count)
+      if (v < -LocateSlack || w < -LocateSlack || v + w > 1.0f + LocateSlack) {
+        continue;
+      }
+
+      glm::vec3 weights = glm::max(glm::vec3(1.0f - v - w, v, w), 0.0f);
+      weights /= weights.x + weights.y + weights.z;
+      float z = weights.x * a3.z + weights.y * b3.z + weights.z * c3.z;
+      float height = std::abs(z - world_point.z);
+      if (height < found_height) {
+        found_height = height;
+        found->triangle = t;
+        found->weights = weights;
+      }
+    }
+  }
+  return found_height != std::numeric_limits<float>::infinity();
+}
+
+// Closest point search using the grid: the floor straight below (or above) a
+// point is a good guess, and any closer triangle must overlap the cells within
+// that guess's distance of the point, so (if that's only a few cells) just
+// those need checking. Returns false (leaving a guess) if the bvh is needed:
+static bool find_closest_in_grid(WalkMesh const &mesh,
+                                 glm::vec3 const &world_point,
+                                 WalkMesh::WalkPoint *closest,
+                                 float *closest_dist2) {
+  WalkMesh::WalkPoint below;
+  if (!locate_in_grid(mesh, world_point, &below)) return false;
+  guess_closest(mesh, below.triangle, world_point, closest, closest_dist2);
+  float radius = std::sqrt(*closest_dist2);
+  if (radius > mesh.grid_cell_size) return false;
+
+  glm::vec2 at = glm::vec2(world_point) - mesh.grid_origin;
+  glm::vec2 lo = glm::max((at - radius) / mesh.grid_cell_size, 0.0f);
+  glm::vec2 hi = (at + radius) / mesh.grid_cell_size;
+  uint32_t x_end = std::min(uint32_t(hi.x) + 1, mesh.grid_columns);
+  uint32_t y_end = std::min(uint32_t(hi.y) + 1, mesh.grid_rows);
+  for (uint32_t y = uint32_t(lo.y); y < y_end; ++y) {
+    for (uint32_t x = uint32_t(lo.x); x < x_end; ++x) {
+      uint32_t c = y * mesh.grid_columns + x;
+      for (uint32_t i = mesh.grid_offsets[c]; i < mesh.grid_offsets[c + 1];
+           ++i) {
+        for (uint32_t t = mesh.grid_triangles[i]; t != -1U;
+             t = mesh.next_piece(t)) {
+          if (mesh.removed(t)) continue;
+          guess_closest(mesh, t, world_point, closest, closest_dist2);
+        }
+      }
+    }
   }
+  return true;
 }
 
 WalkMesh::WalkPoint WalkMesh::start(glm::vec3 const &world_point) const {
   WalkPoint closest;
-  // TODO: iterate through triangles
-  // TODO: for each triangle, find closest point on triangle to world_point
-  // TODO: if point is closest, closest.triangle gets the current triangle,
-  // closest.weights gets the barycentric coordinates
+  float closest_dist2 = std::numeric_limits<float>::infinity();
+  if (!find_closest_in_grid(*this, world_point, &closest, &closest_dist2)) {
+    find_closest(*this, world_point, &closest, &closest_dist2);
+  }
+  return closest;
+}
 
-  float min_dist = std::numeric_limits<float>::max();
+WalkMesh::WalkPoint WalkMesh::locate(glm::vec3 const &world_point) const {
+  WalkPoint found;
+  if (locate_in_grid(*this, world_point, &found)) return found;
+  return start(world_point);
+}
 
-  for (const glm::uvec3 &tri_indices : triangles) {
-    std::array<glm::vec3, 3> tri_verts = {{vertices[tri_indices[0]],
-                                           vertices[tri_indices[1]],
-                                           vertices[tri_indices[2]]}};
-    glm::vec3 point = closest_point_on_triangle(tri_verts, world_point);
-    if (glm::distance(point, world_point) < min_dist) {
-      min_dist = glm::distance(point, world_point);
-      closest.triangle = tri_indices;
-      closest.weights =
-          barycentric(point, vertices[tri_indices[0]], vertices[tri_indices[1]],
-                      vertices[tri_indices[2]]);
+void WalkMesh::start_many(std::vector<glm::vec3> const &world_points,
+                          std::vector<WalkPoint> *walk_points_) const {
+  assert(walk_points_);
+  auto &walk_points = *walk_points_;
+  walk_points.assign(world_points.size(), WalkPoint());
+  if (world_points.empty()) return;
+
+  // visit the points in Morton (z-curve) order, so that consecutive queries
+  // are usually near each other:
+  glm::vec3 min(std::numeric_limits<float>::infinity());
+  glm::vec3 max(-std::numeric_limits<float>::infinity());
+  for (auto const &p : world_points) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  glm::vec3 scale = 1023.0f / glm::max(max - min, glm::vec3(1e-6f));
+  auto spread_bits = [](uint32_t x) {
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+  };
+  std::vector<std::pair<uint32_t, uint32_t>> order(world_points.size());
+  for (uint32_t i = 0; i < world_points.size(); ++i) {
+    glm::uvec3 cell = glm::uvec3((world_points[i] - min) * scale);
+    order[i].first = spread_bits(cell.x) | (spread_bits(cell.y) << 1) |
+                     (spread_bits(cell.z) << 2);
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end());
+
+  // the previous answer gives an upper bound that prunes most of the tree:
+  uint32_t previous = -1U;
+  for (auto const &entry : order) {
+    glm::vec3 const &world_point = world_points[entry.second];
+    WalkPoint &closest = walk_points[entry.second];
+    float closest_dist2 = std::numeric_limits<float>::infinity();
+    if (previous != -1U) {
+      guess_closest(*this, previous, world_point, &closest, &closest_dist2);
+    }
+    if (!find_closest_in_grid(*this, world_point, &closest, &closest_dist2)) {
+      find_closest(*this, world_point, &closest, &closest_dist2);
     }
+    previous = closest.triangle;
   }
+}
 
-  return closest;
+WalkMesh::WalkResult WalkMesh::walk(WalkPoint &wp, glm::vec3 const &step,
+                                   uint32_t max_crossings) const {
+  return trace(wp, step, max_crossings, true);
 }
 
-void WalkMesh::walk(WalkPoint &wp, glm::vec3 const &step,
-                    uint32_t depth) const {
-  // TODO: project step to barycentric coordinates to get weights_step
-  //  glm::vec3 weights_step;
-  glm::vec3 world_projected = world_point(wp) + step;
-  glm::vec3 projected_weights =
-      barycentric(world_projected, vertices[wp.triangle[0]],
-                  vertices[wp.triangle[1]], vertices[wp.triangle[2]]);
-  glm::vec3 weights_step = projected_weights - wp.weights;
-
-  //  std::cout << "depth: " << depth << std::endl;
-  //  std::cout << "current triangle: " << glm::to_string(wp.triangle) <<
-  //  std::endl; std::cout << "current barycentric loc: " <<
-  //  glm::to_string(wp.weights)
-  //            << std::endl;
-  //  std::cout << "projected to barycentric go: "
-  //            << glm::to_string(projected_weights) << std::endl;
-  //  std::cout << "barycentric step: " << glm::to_string(weights_step)
-  //            << std::endl;
-  //  std::cout << "current world step: " << glm::to_string(step) << std::endl;
-
-  // super hacky, just kill the recursion if encountering numerical instability
-  if (depth > 10) {
-    return;
-  }
-
-  if (projected_weights.x >= 0 && projected_weights.y >= 0 &&
-      projected_weights.z >= 0) {  // if a triangle edge is not crossed
-    // TODO: wp.weights gets moved by weights_step, nothing else needs to be
-    // done.
-    wp.weights = projected_weights;
-
-  } else {  // if a triangle edge is crossed
-    // TODO: wp.weights gets moved to triangle edge, and step gets reduced
-    glm::uvec2 crossed_edge;
-    float reduced_coeff = 0.0f;
-
-    if (projected_weights.x < 0) {
-      reduced_coeff = wp.weights.x / -weights_step.x;
-      crossed_edge = glm::uvec2(wp.triangle[1], wp.triangle[2]);
-    } else if (projected_weights.y < 0) {
-      reduced_coeff = wp.weights.y / -weights_step.y;
-      crossed_edge = glm::uvec2(wp.triangle[2], wp.triangle[0]);
-    } else if (projected_weights.z < 0) {
-      reduced_coeff = wp.weights.z / -weights_step.z;
-      crossed_edge = glm::uvec2(wp.triangle[0], wp.triangle[1]);
+WalkMesh::WalkResult WalkMesh::trace(WalkPoint &wp, glm::vec3 const &step,
+                                    uint32_t max_crossings, bool slide) const {
+  WalkResult result;
+  float step_length = glm::length(step);
+  if (step_length == 0.0f) {
+    result.consumed = 1.0f;
+    return result;
+  }
+
+  glm::vec3 remaining = step;
+  // the edge the point is sitting on after the last event (the one it came in
+  // over, or the boundary edge it is sliding along); the step can't leave
+  // through it, which keeps rounding from bouncing the point back and forth:
+  uint32_t entry_edge = -1U;
+  bool sliding = false;
+  for (uint32_t events = 0; events <= max_crossings; ++events) {
+    glm::uvec3 const &tri = triangles[wp.triangle];
+    glm::vec3 projected_weights =
+        wp.weights + weights_step(wp.triangle, remaining);
+    if (entry_edge != -1U && projected_weights[entry_edge] < 0.0f) {
+      projected_weights[entry_edge] = 0.0f;
+      projected_weights /=
+          projected_weights.x + projected_weights.y + projected_weights.z;
+    }
+
+    if (projected_weights.x >= 0.0f && projected_weights.y >= 0.0f &&
+        projected_weights.z >= 0.0f) {  // the step ends in this triangle
+      wp.weights = projected_weights;
+      remaining = glm::vec3(0.0f);
+      break;
+    }
+    if (events == max_crossings) break;  // out of budget
+
+    // move to the edge the step leaves through first (edge i is the edge
+    // opposite vertex i):
+    glm::vec3 step_weights = projected_weights - wp.weights;
+    uint32_t crossed_edge = -1U;
+    float along = 1.0f;
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (projected_weights[i] < 0.0f && step_weights[i] < 0.0f) {
+        float t = glm::clamp(wp.weights[i] / -step_weights[i], 0.0f, 1.0f);
+        if (crossed_edge == -1U || t < along) {
+          crossed_edge = i;
+          along = t;
+        }
+      }
+    }
+    assert(crossed_edge != -1U);
+
+    wp.weights += step_weights * along;
+    wp.weights[crossed_edge] = 0.0f;
+    wp.weights = glm::max(wp.weights, glm::vec3(0.0f));
+    wp.weights /= wp.weights.x + wp.weights.y + wp.weights.z;
+    remaining *= 1.0f - along;
+
+    glm::vec3 edge_vector = vertices[tri[(crossed_edge + 2) % 3]] -
+                            vertices[tri[(crossed_edge + 1) % 3]];
+    uint32_t next_triangle = neighbors[wp.triangle][crossed_edge];
+    if (next_triangle != -1U) {
+      // the shared edge runs the opposite way in the neighbor, so the weights
+      // of its endpoints swap places:
+      uint32_t next_edge = neighbor_edges[wp.triangle][crossed_edge];
+      glm::vec3 next_weights;
+      next_weights[next_edge] = 0.0f;
+      next_weights[(next_edge + 1) % 3] = wp.weights[(crossed_edge + 2) % 3];
+      next_weights[(next_edge + 2) % 3] = wp.weights[(crossed_edge + 1) % 3];
+
+      // rotate the step over the edge, so it keeps heading away from the
+      // edge on the neighbor even if the two triangles aren't coplanar:
+      glm::vec3 edge_dir = glm::normalize(edge_vector);
+      glm::vec3 out_dir = glm::cross(edge_dir, triangle_normals[wp.triangle]);
+      glm::vec3 in_dir = glm::cross(edge_dir, triangle_normals[next_triangle]);
+      remaining = glm::dot(remaining, edge_dir) * edge_dir +
+                  glm::dot(remaining, out_dir) * in_dir;
+
+      wp.triangle = next_triangle;
+      wp.weights = next_weights;
+      entry_edge = next_edge;
+      sliding = false;
+      result.crossings += 1;
+    } else if (!slide || (!triangle_borders.empty() &&
+                          (triangle_borders[wp.triangle] &
+                           (1 << crossed_edge)))) {
+      // tile border (the tile's owner carries on in the neighboring tile), or
+      // a boundary when not sliding: stop on the edge
+      result.border_edge = crossed_edge;
+      break;
     } else {
-      std::cout << "this is really not supposed to happen!" << std::endl;
-    }
-
-    wp.weights += weights_step * reduced_coeff;
-    glm::vec3 world_point_edge = world_point(wp);
-    glm::vec3 reduced_step = world_projected - world_point_edge;
-
-    // if there is another triangle over the edge:
-    // TODO: wp.triangle gets updated to adjacent triangle
-    // TODO: step gets rotated over the edge
-    if (next_vertex.find(glm::uvec2(crossed_edge.y, crossed_edge.x)) !=
-        next_vertex.end()) {
-      auto third_vertex =
-          next_vertex.at(glm::uvec2(crossed_edge.y, crossed_edge.x));
-
-      auto result = std::find_if(
-          triangles.begin(), triangles.end(), [&](glm::uvec3 triangle) {
-            return (crossed_edge.x == triangle.x ||
-                    crossed_edge.x == triangle.y ||
-                    crossed_edge.x == triangle.z) &&
-                   (crossed_edge.y == triangle.x ||
-                    crossed_edge.y == triangle.y ||
-                    crossed_edge.y == triangle.z) &&
-                   (third_vertex == triangle.x || third_vertex == triangle.y ||
-                    third_vertex == triangle.z);
-          });
-
-      if (result != triangles.end()) {
-        wp.triangle = *result;
-        wp.weights =
-            barycentric(world_point_edge, vertices[wp.triangle[0]],
-                        vertices[wp.triangle[1]], vertices[wp.triangle[2]]);
-        walk(wp, reduced_step, depth + 1);
+      // boundary edge: keep only the part of the step that slides along it
+      // (stuck in a corner if this happens twice without moving)
+      if (along == 0.0f && sliding) {
+        remaining = glm::vec3(0.0f);
+        break;
+      }
+      remaining = glm::dot(edge_vector, remaining) * edge_vector /
+                  glm::length2(edge_vector);
+      entry_edge = crossed_edge;
+      sliding = true;
+    }
+  }
+
+  // (the part of the step pushed into a boundary counts as used; only the
+  //  part left over when the budget ran out does not)
+  result.consumed = 1.0f - glm::length(remaining) / step_length;
+  result.remaining = remaining;
+  return result;
+}
+
+void WalkMesh::walk_many(std::vector<glm::vec3> const &steps,
+                         std::vector<WalkPoint> *walk_points_) const {
+  assert(walk_points_);
+  auto &walk_points = *walk_points_;
+  assert(walk_points.size() == steps.size());
+
+  uint32_t i = 0;
+#ifdef WALK_MESH_SSE
+  // four walk points per pass; each lane computes its new weights and the
+  // lanes that stay inside their triangle are written back directly:
+  for (; i + 4 <= walk_points.size(); i += 4) {
+    WalkPoint *wp = &walk_points[i];
+    glm::vec3 const *step = &steps[i];
+
+    // gather lanes into SoA form: lanes[c], lanes[3 + c], lanes[6 + c] and
+    // lanes[9 + c] hold component c of step, gradient_v, gradient_w, weights:
+    alignas(16) float lanes[12][4];
+    for (uint32_t l = 0; l < 4; ++l) {
+      glm::vec3 const &gradient_v = triangle_gradient_v[wp[l].triangle];
+      glm::vec3 const &gradient_w = triangle_gradient_w[wp[l].triangle];
+      for (uint32_t c = 0; c < 3; ++c) {
+        lanes[c][l] = step[l][c];
+        lanes[3 + c][l] = gradient_v[c];
+        lanes[6 + c][l] = gradient_w[c];
+        lanes[9 + c][l] = wp[l].weights[c];
+      }
+    }
+
+    // same math as weights_step(), four lanes at a time:
+    __m128 dv = _mm_setzero_ps();
+    __m128 dw = _mm_setzero_ps();
+    for (uint32_t c = 0; c < 3; ++c) {
+      __m128 step_c = _mm_load_ps(lanes[c]);
+      dv = _mm_add_ps(dv, _mm_mul_ps(step_c, _mm_load_ps(lanes[3 + c])));
+      dw = _mm_add_ps(dw, _mm_mul_ps(step_c, _mm_load_ps(lanes[6 + c])));
+    }
+    __m128 u = _mm_sub_ps(_mm_load_ps(lanes[9]), _mm_add_ps(dv, dw));
+    __m128 v = _mm_add_ps(_mm_load_ps(lanes[10]), dv);
+    __m128 w = _mm_add_ps(_mm_load_ps(lanes[11]), dw);
+
+    __m128 zero = _mm_setzero_ps();
+    int inside = _mm_movemask_ps(
+        _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                   _mm_cmpge_ps(w, zero)));
+
+    alignas(16) float out_u[4], out_v[4], out_w[4];
+    _mm_store_ps(out_u, u);
+    _mm_store_ps(out_v, v);
+    _mm_store_ps(out_w, w);
+    for (uint32_t l = 0; l < 4; ++l) {
+      if (inside & (1 << l)) {
+        wp[l].weights = glm::vec3(out_u[l], out_v[l], out_w[l]);
       } else {
-        std::cout << "should be able to find triangle!!" << std::endl;
+        walk(wp[l], step[l]);
       }
+    }
+  }
+#endif  // WALK_MESH_SSE
+
+  for (; i < walk_points.size(); ++i) {
+    walk(walk_points[i], steps[i]);
+  }
+}
+
+bool WalkMesh::line_of_sight(WalkPoint const &from, WalkPoint const &to,
+                             uint32_t max_crossings) const {
+  glm::vec3 target = world_point(to);
+  WalkPoint at = from;
+  // steps get shortened by sloped triangles, so re-aim a few times; on flat
+  // ground the first leg already ends at the target:
+  for (uint32_t leg = 0; leg < 4; ++leg) {
+    if (at.triangle == to.triangle) return true;  // (triangles are convex)
+    WalkResult result =
+        trace(at, target - world_point(at), max_crossings, false);
+    if (result.border_edge != -1U || result.consumed < 1.0f) {
+      // ran into a boundary or out of budget (unless already at the target,
+      // which can happen for targets right on a boundary edge):
+      return glm::distance2(world_point(at), target) < 1e-6f;
+    }
+    max_crossings -= std::min(max_crossings, result.crossings);
+  }
+  return at.triangle == to.triangle ||
+         glm::distance2(world_point(at), target) < 1e-6f;
+}
+
+// Slab test; returns the distance along the ray at which it enters the box
+// (or infinity if it misses the box or enters beyond 'max_distance'):
+static float ray_enters_box(glm::vec3 const &origin,
+                            glm::vec3 const &inv_direction, float max_distance,
+                            glm::vec3 const &min, glm::vec3 const &max) {
+  glm::vec3 t0 = (min - origin) * inv_direction;
+  glm::vec3 t1 = (max - origin) * inv_direction;
+  glm::vec3 near = glm::min(t0, t1);
+  glm::vec3 far = glm::max(t0, t1);
+  float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+  float exit = std::min(std::min(far.x, far.y), std::min(far.z, max_distance));
+  if (!(enter <= exit)) return std::numeric_limits<float>::infinity();
+  return enter;
+}
+
+bool WalkMesh::raycast(glm::vec3 const &origin, glm::vec3 const &direction,
+                       float max_distance, WalkPoint *hit,
+                       float *hit_distance) const {
+  if (bvh_nodes.empty()) return false;
+
+  // (division by zero gives infinities, which the slab test handles)
+  glm::vec3 inv_direction = 1.0f / direction;
+  float best = max_distance;
+  bool found = false;
+
+  uint32_t stack[64];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size) {
+    BVHNode const &node = bvh_nodes[stack[--stack_size]];
+    if (ray_enters_box(origin, inv_direction, best, node.min, node.max) ==
+        std::numeric_limits<float>::infinity()) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      // visit the child the ray enters first by pushing it last:
+      BVHNode const &a = bvh_nodes[node.first];
+      BVHNode const &b = bvh_nodes[node.first + 1];
+      if (ray_enters_box(origin, inv_direction, best, a.min, a.max) <
+          ray_enters_box(origin, inv_direction, best, b.min, b.max)) {
+        stack[stack_size++] = node.first + 1;
+        stack[stack_size++] = node.first;
+      } else {
+        stack[stack_size++] = node.first;
+        stack[stack_size++] = node.first + 1;
+      }
+      continue;
+    }
+
+    // Moller-Trumbore ray/triangle intersection:
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+      for (uint32_t t = bvh_triangles[i]; t != -1U; t = next_piece(t)) {
+        if (removed(t)) continue;
+        glm::uvec3 const &tri = triangles[t];
+        glm::vec3 edge1 = vertices[tri.y] - vertices[tri.x];
+        glm::vec3 edge2 = vertices[tri.z] - vertices[tri.x];
+        glm::vec3 p = glm::cross(direction, edge2);
+        float det = glm::dot(edge1, p);
+        if (det == 0.0f) continue;  // ray is parallel to the triangle
+        float inv_det = 1.0f / det;
+        glm::vec3 offset = origin - vertices[tri.x];
+        float v = glm::dot(offset, p) * inv_det;
+        if (v < 0.0f || v > 1.0f) continue;
+        glm::vec3 q = glm::cross(offset, edge1);
+        float w = glm::dot(direction, q) * inv_det;
+        if (w < 0.0f || v + w > 1.0f) continue;
+        float distance = glm::dot(edge2, q) * inv_det;
+        if (distance < 0.0f || distance > best) continue;
+        best = distance;
+        found = true;
+        if (hit) {
+          hit->triangle = t;
+          hit->weights = glm::vec3(1.0f - v - w, v, w);
+        }
+      }
+    }
+  }
+
+  if (found && hit_distance) *hit_distance = best;
+  return found;
+}
+
+//------ carving ------
+
+// Triangles steeper than this (by face normal z) aren't carved, since they
+// don't have a usable shadow in the xy plane:
+static const float CarveMinNormalZ = 0.1f;
+
+namespace {
+
+// Carving clips triangles against the edges of the footprint one at a time.
+// New points are keyed by what they're made from (a mesh edge and a footprint
+// line, or two footprint lines and the triangle whose plane they're in), and
+// their positions are computed from the key alone, so the same point cut from
+// two triangles comes out bit-for-bit the same and becomes one vertex:
+struct CarveKey {
+  enum Kind : uint32_t {
+    Vertex,  // mesh vertex a
+    Edge,    // where line c crosses the mesh edge between vertices a < b
+    Corner,  // where lines a < b cross, in the plane of triangle c
+    Center,  // middle of piece b of triangle a (see triangulate())
+  };
+  uint32_t kind, a, b, c;
+  bool operator<(CarveKey const &o) const {
+    return std::tie(kind, a, b, c) < std::tie(o.kind, o.a, o.b, o.c);
+  }
+  bool operator==(CarveKey const &o) const {
+    return kind == o.kind && a == o.a && b == o.b && c == o.c;
+  }
+};
+
+// a corner of a polygon being clipped; 'support' says what its outgoing edge
+// lies along (< 3: that edge of the triangle being cut, otherwise footprint
+// line support - 3):
+struct ClipVertex {
+  glm::vec2 xy;
+  CarveKey key;
+  uint32_t support;
+  bool inserted;  // added later, in the middle of a straight edge
+};
+typedef std::vector<ClipVertex> ClipPolygon;
+
+// a triangle made by carving, before its vertices exist:
+struct CarvedTriangle {
+  ClipVertex corners[3];
+  uint8_t border;  // (bits of the original triangle's borders it keeps)
+};
+
+bool boxes_overlap(glm::vec3 const &a_min, glm::vec3 const &a_max,
+                   glm::vec3 const &b_min, glm::vec3 const &b_max) {
+  return a_min.x <= b_max.x && b_min.x <= a_max.x && a_min.y <= b_max.y &&
+         b_min.y <= a_max.y && a_min.z <= b_max.z && b_min.z <= a_max.z;
+}
+
+float cross2(glm::vec2 const &a, glm::vec2 const &b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+// (measured from the first corner, so small polygons far from the origin
+// don't lose their area to rounding)
+float polygon_area(ClipPolygon const &polygon) {
+  float area = 0.0f;
+  for (uint32_t i = 1; i + 1 < polygon.size(); ++i) {
+    area += cross2(polygon[i].xy - polygon[0].xy,
+                   polygon[i + 1].xy - polygon[0].xy);
+  }
+  return 0.5f * area;
+}
+
+struct Carver {
+  WalkMesh const &mesh;
+  std::vector<glm::vec2> points;  // footprint, CCW
+
+  // > 0 inside footprint line k:
+  float side(uint32_t k, glm::vec2 const &p) const {
+    glm::vec2 const &a = points[k];
+    glm::vec2 const &b = points[(k + 1) % points.size()];
+    return cross2(b - a, p - a);
+  }
+
+  // where along mesh edge a -> b (with a < b) line k crosses:
+  float edge_amount(uint32_t a, uint32_t b, uint32_t k) const {
+    float sa = side(k, glm::vec2(mesh.vertices[a]));
+    float sb = side(k, glm::vec2(mesh.vertices[b]));
+    return sa / (sa - sb);
+  }
+
+  glm::vec2 key_xy(CarveKey const &key) const {
+    if (key.kind == CarveKey::Vertex) {
+      return glm::vec2(mesh.vertices[key.a]);
+    } else if (key.kind == CarveKey::Edge) {
+      float amt = edge_amount(key.a, key.b, key.c);
+      return glm::mix(glm::vec2(mesh.vertices[key.a]),
+                      glm::vec2(mesh.vertices[key.b]), amt);
     } else {
-      glm::vec3 crossed_vector =
-          vertices[crossed_edge[1]] - vertices[crossed_edge[0]];
-      glm::vec3 added_step = glm::dot(crossed_vector, reduced_step) *
-                             crossed_vector / glm::length2(crossed_vector);
-      wp.weights =
-          barycentric(world_point_edge + added_step, vertices[wp.triangle[0]],
-                      vertices[wp.triangle[1]], vertices[wp.triangle[2]]);
-      //      walk(wp, weights_step);
+      assert(key.kind == CarveKey::Corner);
+      glm::vec2 const &pa = points[key.a];
+      glm::vec2 da = points[(key.a + 1) % points.size()] - pa;
+      glm::vec2 const &pb = points[key.b];
+      glm::vec2 db = points[(key.b + 1) % points.size()] - pb;
+      return pa + da * (cross2(pb - pa, db) / cross2(da, db));
     }
+  }
 
-    // else if there is no other triangle over the edge:
-    // TODO: wp.triangle stays the same.
-    // TODO: step gets updated to slide along the edge
+  // the point where line k crosses an edge of triangle t with 'support':
+  ClipVertex crossing(uint32_t t, glm::uvec3 const &tri, uint32_t support,
+                      uint32_t k) const {
+    ClipVertex cv;
+    if (support < 3) {
+      uint32_t a = tri[(support + 1) % 3], b = tri[(support + 2) % 3];
+      cv.key = CarveKey{CarveKey::Edge, std::min(a, b), std::max(a, b), k};
+    } else {
+      uint32_t m = support - 3;
+      cv.key = CarveKey{CarveKey::Corner, std::min(m, k), std::max(m, k), t};
+    }
+    cv.xy = key_xy(cv.key);
+    cv.inserted = false;
+    return cv;
   }
+
+  // splits 'polygon' (part of triangle t) along line k:
+  void clip(uint32_t t, glm::uvec3 const &tri, ClipPolygon const &polygon,
+            uint32_t k, ClipPolygon *inside, ClipPolygon *outside) const {
+    inside->clear();
+    outside->clear();
+    uint32_t line = 3 + k;
+    for (uint32_t i = 0; i < polygon.size(); ++i) {
+      ClipVertex const &at = polygon[i];
+      ClipVertex const &next = polygon[(i + 1) % polygon.size()];
+      float sa = side(k, at.xy);
+      float sn = side(k, next.xy);
+      // (points right on the line go in both)
+      if (sa >= 0.0f) {
+        inside->emplace_back(at);
+        if (!(sa > 0.0f || sn >= 0.0f)) inside->back().support = line;
+      }
+      if (sa <= 0.0f) {
+        outside->emplace_back(at);
+        if (!(sa < 0.0f || sn <= 0.0f)) outside->back().support = line;
+      }
+      if ((sa > 0.0f && sn < 0.0f) || (sa < 0.0f && sn > 0.0f)) {
+        ClipVertex cross = crossing(t, tri, at.support, k);
+        // leaving a side, the polygon carries on along the line:
+        cross.support = (sa > 0.0f ? line : at.support);
+        inside->emplace_back(cross);
+        cross.support = (sa < 0.0f ? line : at.support);
+        outside->emplace_back(cross);
+      }
+    }
+  }
+};
+
+// Fans a convex polygon (part of triangle t) into triangles. Inserted corners
+// sit in the middle of straight edges, so the fan has to start somewhere that
+// won't make flat triangles -- or else from a new point in the middle:
+void triangulate(uint32_t t, uint32_t piece, ClipPolygon const &polygon,
+                 uint8_t borders, std::vector<CarvedTriangle> *out) {
+  uint32_t n = uint32_t(polygon.size());
+  auto border_bit = [&](uint32_t i) -> uint8_t {
+    uint32_t support = polygon[i % n].support;
+    return (support < 3 ? ((borders >> support) & 1) : 0);
+  };
+
+  uint32_t apex = -1U;
+  for (uint32_t i = 0; i < n && apex == -1U; ++i) {
+    if (!polygon[(i + n - 1) % n].inserted && !polygon[i].inserted &&
+        !polygon[(i + 1) % n].inserted) {
+      apex = i;
+    }
+  }
+
+  if (apex != -1U) {
+    for (uint32_t j = apex + 1; j + 1 < apex + n; ++j) {
+      CarvedTriangle tri;
+      tri.corners[0] = polygon[apex];
+      tri.corners[1] = polygon[j % n];
+      tri.corners[2] = polygon[(j + 1) % n];
+      // edge i is opposite corner i:
+      tri.border = uint8_t(border_bit(j) << 0);
+      if (j + 2 == apex + n) tri.border |= uint8_t(border_bit(j + 1) << 1);
+      if (j == apex + 1) tri.border |= uint8_t(border_bit(apex) << 2);
+      out->emplace_back(tri);
+    }
+  } else {
+    ClipVertex center;
+    center.xy = glm::vec2(0.0f);
+    for (auto const &cv : polygon) center.xy += cv.xy;
+    center.xy /= float(n);
+    center.key = CarveKey{CarveKey::Center, t, piece, 0};
+    center.inserted = false;
+    for (uint32_t i = 0; i < n; ++i) {
+      CarvedTriangle tri;
+      tri.corners[0] = center;
+      tri.corners[1] = polygon[i];
+      tri.corners[2] = polygon[(i + 1) % n];
+      tri.border = border_bit(i);
+      out->emplace_back(tri);
+    }
+  }
+}
+
+}  // namespace
+
+WalkMesh::CarveResult WalkMesh::carve(std::vector<glm::vec2> const &footprint,
+                                      float min_z, float max_z,
+                                      std::vector<WalkPoint> *walk_points) {
+  CarveResult result;
+  if (footprint.size() < 3) return result;
+
+  Carver carver{*this, footprint};
+  {  // (lines go counterclockwise, so "inside" is to their left)
+    ClipPolygon outline(footprint.size());
+    for (uint32_t i = 0; i < footprint.size(); ++i) {
+      outline[i].xy = footprint[i];
+    }
+    if (polygon_area(outline) < 0.0f) {
+      std::reverse(carver.points.begin(), carver.points.end());
+    }
+  }
+  uint32_t lines = uint32_t(carver.points.size());
+
+  glm::vec3 box_min = glm::vec3(carver.points[0], min_z);
+  glm::vec3 box_max = glm::vec3(carver.points[0], max_z);
+  for (auto const &p : carver.points) {
+    box_min = glm::min(box_min, glm::vec3(p, min_z));
+    box_max = glm::max(box_max, glm::vec3(p, max_z));
+  }
+
+  // triangles (and pieces) whose bounds overlap the footprint:
+  std::vector<uint32_t> candidates;
+  {
+    uint32_t stack[64];
+    uint32_t stack_size = 0;
+    if (!bvh_nodes.empty()) stack[stack_size++] = 0;
+    while (stack_size) {
+      BVHNode const &node = bvh_nodes[stack[--stack_size]];
+      if (!boxes_overlap(node.min, node.max, box_min, box_max)) continue;
+      if (node.count == 0) {
+        stack[stack_size++] = node.first;
+        stack[stack_size++] = node.first + 1;
+        continue;
+      }
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        for (uint32_t t = bvh_triangles[i]; t != -1U; t = next_piece(t)) {
+          if (removed(t)) continue;
+          glm::uvec3 const &tri = triangles[t];
+          glm::vec3 tri_min = glm::min(vertices[tri.x],
+                                       glm::min(vertices[tri.y],
+                                                vertices[tri.z]));
+          glm::vec3 tri_max = glm::max(vertices[tri.x],
+                                       glm::max(vertices[tri.y],
+                                                vertices[tri.z]));
+          if (!boxes_overlap(tri_min, tri_max, box_min, box_max)) continue;
+          if (std::abs(triangle_normals[t].z) < CarveMinNormalZ) continue;
+          candidates.emplace_back(t);
+        }
+      }
+    }
+  }
+
+  // cut each candidate into the pieces outside the footprint; a candidate
+  // is only cut if some of it is inside:
+  struct Touched {
+    uint32_t triangle;
+    std::vector<CarvedTriangle> triangles;  // (empty if carved away)
+    std::vector<uint32_t> pieces;           // indices, once written
+  };
+  std::vector<Touched> touched;
+  std::vector<ClipPolygon> pieces;
+  ClipPolygon current, inside, outside;
+  for (uint32_t t : candidates) {
+    glm::uvec3 const &tri = triangles[t];
+    current.resize(3);
+    for (uint32_t i = 0; i < 3; ++i) {
+      current[i].xy = glm::vec2(vertices[tri[i]]);
+      current[i].key = CarveKey{CarveKey::Vertex, tri[i], 0, 0};
+      current[i].support = (i + 2) % 3;  // (the edge to the next corner)
+      current[i].inserted = false;
+    }
+    float area = std::abs(polygon_area(current));
+    pieces.clear();
+    for (uint32_t k = 0; k < lines && current.size() >= 3; ++k) {
+      carver.clip(t, tri, current, k, &inside, &outside);
+      if (outside.size() >= 3) pieces.emplace_back(outside);
+      std::swap(current, inside);
+    }
+    // (barely touching doesn't count)
+    if (current.size() < 3) continue;
+    if (!pieces.empty() && std::abs(polygon_area(current)) <= 1e-6f * area) {
+      continue;
+    }
+
+    // pieces along the same footprint line have to share corners, so add
+    // every corner on a line to the piece edges along it that pass it:
+    std::vector<std::pair<uint32_t, ClipVertex>> on_lines;
+    for (auto const &piece : pieces) {
+      for (auto const &cv : piece) {
+        if (cv.key.kind == CarveKey::Edge) {
+          on_lines.emplace_back(cv.key.c, cv);
+        } else if (cv.key.kind == CarveKey::Corner) {
+          on_lines.emplace_back(cv.key.a, cv);
+          on_lines.emplace_back(cv.key.b, cv);
+        }
+      }
+    }
+    Touched cut;
+    cut.triangle = t;
+    uint8_t borders = (triangle_borders.empty() ? 0 : triangle_borders[t]);
+    for (uint32_t p = 0; p < pieces.size(); ++p) {
+      ClipPolygon fixed;
+      ClipPolygon const &piece = pieces[p];
+      for (uint32_t i = 0; i < piece.size(); ++i) {
+        fixed.emplace_back(piece[i]);
+        if (piece[i].support < 3) continue;
+        glm::vec2 from = piece[i].xy;
+        glm::vec2 along = piece[(i + 1) % piece.size()].xy - from;
+        std::vector<std::pair<float, ClipVertex>> between;
+        for (auto const &entry : on_lines) {
+          if (entry.first != piece[i].support - 3) continue;
+          float amt = glm::dot(entry.second.xy - from, along) /
+                      glm::dot(along, along);
+          if (!(amt > 1e-6f && amt < 1.0f - 1e-6f)) continue;
+          bool seen = false;
+          for (auto const &b : between) {
+            seen = seen || b.second.key == entry.second.key;
+          }
+          if (!seen) between.emplace_back(amt, entry.second);
+        }
+        std::sort(between.begin(), between.end(),
+                  [](std::pair<float, ClipVertex> const &a,
+                     std::pair<float, ClipVertex> const &b) {
+                    return a.first < b.first;
+                  });
+        for (auto &b : between) {
+          b.second.support = piece[i].support;
+          b.second.inserted = true;
+          fixed.emplace_back(b.second);
+        }
+      }
+      triangulate(t, p, fixed, borders, &cut.triangles);
+    }
+    touched.emplace_back(cut);
+  }
+  result.cut = uint32_t(touched.size());
+  if (touched.empty()) return result;
+
+  // neighbors that weren't cut but share an edge that now has new vertices
+  // on it get split to match:
+  std::map<std::pair<uint32_t, uint32_t>, std::vector<ClipVertex>> edge_splits;
+  for (auto const &cut : touched) {
+    for (auto const &tri : cut.triangles) {
+      for (auto const &cv : tri.corners) {
+        if (cv.key.kind != CarveKey::Edge) continue;
+        auto &splits = edge_splits[std::make_pair(cv.key.a, cv.key.b)];
+        bool seen = false;
+        for (auto const &s : splits) seen = seen || s.key == cv.key;
+        if (!seen) splits.emplace_back(cv);
+      }
+    }
+  }
+  auto is_cut = [&](uint32_t t) {
+    for (auto const &cut : touched) {
+      if (cut.triangle == t) return true;
+    }
+    return false;
+  };
+  std::vector<uint32_t> split;
+  for (uint32_t c = 0; c < result.cut; ++c) {
+    glm::uvec3 const &next = neighbors[touched[c].triangle];
+    for (uint32_t i = 0; i < 3; ++i) {
+      uint32_t n = next[i];
+      if (n == -1U || is_cut(n)) continue;
+      if (std::find(split.begin(), split.end(), n) != split.end()) continue;
+      glm::uvec3 const &tri = triangles[n];
+      ClipPolygon polygon;
+      for (uint32_t j = 0; j < 3; ++j) {
+        ClipVertex corner;
+        corner.xy = glm::vec2(vertices[tri[j]]);
+        corner.key = CarveKey{CarveKey::Vertex, tri[j], 0, 0};
+        corner.support = (j + 2) % 3;
+        corner.inserted = false;
+        polygon.emplace_back(corner);
+
+        uint32_t a = tri[j], b = tri[(j + 1) % 3];
+        auto f = edge_splits.find(std::make_pair(std::min(a, b),
+                                                 std::max(a, b)));
+        if (f == edge_splits.end()) continue;
+        std::vector<std::pair<float, ClipVertex>> along;
+        for (auto cv : f->second) {
+          float amt = carver.edge_amount(cv.key.a, cv.key.b, cv.key.c);
+          if (cv.key.a != a) amt = 1.0f - amt;
+          cv.support = corner.support;
+          cv.inserted = true;
+          along.emplace_back(amt, cv);
+        }
+        std::sort(along.begin(), along.end(),
+                  [](std::pair<float, ClipVertex> const &x,
+                     std::pair<float, ClipVertex> const &y) {
+                    return x.first < y.first;
+                  });
+        for (auto const &entry : along) polygon.emplace_back(entry.second);
+      }
+      if (polygon.size() == 3) continue;
+
+      split.emplace_back(n);
+      Touched fix;
+      fix.triangle = n;
+      uint8_t borders = (triangle_borders.empty() ? 0 : triangle_borders[n]);
+      triangulate(n, 0, polygon, borders, &fix.triangles);
+      touched.emplace_back(fix);
+    }
+  }
+  result.split = uint32_t(split.size());
+
+  // make the new vertices (positions are lifted from the xy plane onto the
+  // plane of the triangle they were cut from):
+  std::map<CarveKey, uint32_t> made;
+  auto vertex_for = [&](ClipVertex const &cv, uint32_t t) -> uint32_t {
+    if (cv.key.kind == CarveKey::Vertex) return cv.key.a;
+    auto f = made.find(cv.key);
+    if (f != made.end()) return f->second;
+
+    glm::vec3 position, normal;
+    if (cv.key.kind == CarveKey::Edge) {
+      float amt = carver.edge_amount(cv.key.a, cv.key.b, cv.key.c);
+      position = glm::mix(vertices[cv.key.a], vertices[cv.key.b], amt);
+      normal = glm::mix(vertex_normals[cv.key.a], vertex_normals[cv.key.b],
+                        amt);
+    } else {
+      glm::uvec3 const &tri = triangles[t];
+      glm::vec2 a = glm::vec2(vertices[tri.x]);
+      glm::vec2 b = glm::vec2(vertices[tri.y]);
+      glm::vec2 c = glm::vec2(vertices[tri.z]);
+      float area = cross2(b - a, c - a);
+      float v = cross2(cv.xy - a, c - a) / area;
+      float w = cross2(b - a, cv.xy - a) / area;
+      glm::vec3 weights = glm::vec3(1.0f - v - w, v, w);
+      position = weights.x * vertices[tri.x] + weights.y * vertices[tri.y] +
+                 weights.z * vertices[tri.z];
+      normal = weights.x * vertex_normals[tri.x] +
+               weights.y * vertex_normals[tri.y] +
+               weights.z * vertex_normals[tri.z];
+    }
+    uint32_t index = uint32_t(vertices.size());
+    vertices.emplace_back(position);
+    vertex_normals.emplace_back(glm::normalize(normal));
+    made.emplace(cv.key, index);
+    return index;
+  };
+  std::vector<glm::uvec3> made_triangles;
+  std::vector<uint8_t> made_borders;
+  std::vector<uint32_t> made_first;  // (per touched triangle)
+  for (auto const &entry : touched) {
+    made_first.emplace_back(uint32_t(made_triangles.size()));
+    for (auto const &tri : entry.triangles) {
+      glm::uvec3 corners;
+      for (uint32_t i = 0; i < 3; ++i) {
+        corners[i] = vertex_for(tri.corners[i], entry.triangle);
+      }
+      made_triangles.emplace_back(corners);
+      made_borders.emplace_back(tri.border);
+    }
+  }
+  made_first.emplace_back(uint32_t(made_triangles.size()));
+  result.added_vertices = uint32_t(made.size());
+
+  // remember what walk points were on, then write the new triangles -- the
+  // first piece of each touched triangle takes its place:
+  std::vector<std::pair<uint32_t, glm::vec3>> moving;
+  if (walk_points) {
+    for (uint32_t i = 0; i < walk_points->size(); ++i) {
+      WalkPoint const &wp = (*walk_points)[i];
+      for (auto const &entry : touched) {
+        if (entry.triangle == wp.triangle) {
+          moving.emplace_back(i, world_point(wp));
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<std::pair<uint32_t, uint8_t>> ring;  // (triangle, edge)
+  if (triangle_next_piece.empty()) {
+    triangle_next_piece.assign(triangles.size(), -1U);
+    triangle_removed.assign(triangles.size(), 0);
+  }
+  for (uint32_t e = 0; e < touched.size(); ++e) {
+    Touched &entry = touched[e];
+    uint32_t t = entry.triangle;
+    // edges of untouched neighbors pointing here need patching too:
+    for (uint32_t i = 0; i < 3; ++i) {
+      uint32_t n = neighbors[t][i];
+      if (n == -1U) continue;
+      bool n_touched = false;
+      for (auto const &other : touched) {
+        n_touched = n_touched || other.triangle == n;
+      }
+      if (!n_touched) ring.emplace_back(n, neighbor_edges[t][i]);
+    }
+
+    for (uint32_t m = made_first[e]; m < made_first[e + 1]; ++m) {
+      uint32_t index = t;
+      if (m != made_first[e]) {
+        index = uint32_t(triangles.size());
+        triangles.emplace_back();
+        triangle_next_piece.emplace_back(-1U);
+        triangle_removed.emplace_back(0);
+        // (chained right after the last piece so far)
+        uint32_t last = entry.pieces.back();
+        triangle_next_piece[index] = triangle_next_piece[last];
+        triangle_next_piece[last] = index;
+        ++result.added;
+      }
+      triangles[index] = made_triangles[m];
+      entry.pieces.emplace_back(index);
+    }
+    if (entry.pieces.empty()) {
+      triangle_removed[t] = 1;
+      ++result.removed;
+    }
+  }
+  neighbors.resize(triangles.size());
+  neighbor_edges.resize(triangles.size());
+  triangle_gradient_v.resize(triangles.size());
+  triangle_gradient_w.resize(triangles.size());
+  triangle_normals.resize(triangles.size());
+  if (!triangle_borders.empty()) triangle_borders.resize(triangles.size());
+
+  // patch adjacency: match up the edges of the new triangles with each other
+  // and with the untouched neighbors around them:
+  std::map<std::pair<uint32_t, uint32_t>, std::pair<uint32_t, uint8_t>> edges;
+  auto edge_key = [this](uint32_t t, uint32_t i) {
+    glm::uvec3 const &tri = triangles[t];
+    return std::make_pair(tri[(i + 1) % 3], tri[(i + 2) % 3]);
+  };
+  for (auto const &r : ring) {
+    neighbors[r.first][r.second] = -1U;
+    edges[edge_key(r.first, r.second)] = r;
+  }
+  for (uint32_t e = 0; e < touched.size(); ++e) {
+    Touched const &entry = touched[e];
+    if (entry.pieces.empty()) neighbors[entry.triangle] = glm::uvec3(-1U);
+    for (uint32_t p = 0; p < entry.pieces.size(); ++p) {
+      uint32_t t = entry.pieces[p];
+      neighbors[t] = glm::uvec3(-1U);
+      neighbor_edges[t] = glm::u8vec3(0);
+      project_triangle(t);
+      if (!triangle_borders.empty()) {
+        triangle_borders[t] = made_borders[made_first[e] + p];
+      }
+      for (uint8_t i = 0; i < 3; ++i) {
+        edges[edge_key(t, i)] = std::make_pair(t, i);
+      }
+    }
+  }
+  for (auto const &edge : edges) {
+    auto twin = edges.find(std::make_pair(edge.first.second,
+                                          edge.first.first));
+    if (twin == edges.end()) continue;
+    uint32_t t = edge.second.first;
+    uint8_t i = edge.second.second;
+    neighbors[t][i] = twin->second.first;
+    neighbor_edges[t][i] = twin->second.second;
+  }
+
+  // walk points on touched triangles move to the piece under them, or to the
+  // nearest point left if their spot was carved away:
+  for (auto const &move : moving) {
+    WalkPoint &wp = (*walk_points)[move.first];
+    uint32_t old = wp.triangle;
+    wp = WalkPoint();
+    for (auto const &entry : touched) {
+      if (entry.triangle != old) continue;
+      for (uint32_t t : entry.pieces) {
+        glm::uvec3 const &tri = triangles[t];
+        glm::vec2 a = glm::vec2(vertices[tri.x]);
+        glm::vec2 b = glm::vec2(vertices[tri.y]);
+        glm::vec2 c = glm::vec2(vertices[tri.z]);
+        glm::vec2 p = glm::vec2(move.second);
+        float area = cross2(b - a, c - a);
+        if (area == 0.0f) continue;
+        float v = cross2(p - a, c - a) / area;
+        float w = cross2(b - a, p - a) / area;
+        if (v < -LocateSlack || w < -LocateSlack ||
+            v + w > 1.0f + LocateSlack) {
+          continue;
+        }
+        wp.triangle = t;
+        wp.weights = glm::max(glm::vec3(1.0f - v - w, v, w), 0.0f);
+        wp.weights /= wp.weights.x + wp.weights.y + wp.weights.z;
+        break;
+      }
+    }
+    if (wp.triangle == -1U) {
+      wp = start(move.second);
+      ++result.moved;
+    }
+  }
+
+  ++revision;
+  return result;
 }
@@ -5,12 +5,11 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
-#include <unordered_map>
+#include <stdexcept>
 #include <vector>
 #include "read_chunk.hpp"
 
 #define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>  //allows the use of 'uvec2' as an unordered_map key
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 
@@ -21,16 +20,135 @@ struct WalkMesh {
 
   std::vector<glm::vec3> vertex_normals;
 
-  // This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each
-  // triangle, and is useful for checking what's over an edge from a given
-  // point:
-  std::unordered_map<glm::uvec2, uint32_t> next_vertex;
+  // Triangle adjacency, useful for checking what's over an edge from a given
+  // point. Edge i of a triangle is the edge opposite its vertex i:
+  //  neighbors[t][i] is the triangle across edge i of triangle t (or -1U if
+  //  edge i is on the boundary of the mesh)
+  //  neighbor_edges[t][i] is which edge of that neighbor is the shared one
+  std::vector<glm::uvec3> neighbors;
+  std::vector<glm::u8vec3> neighbor_edges;
 
-  // Construct new WalkMesh from file and build next_vertex structure:
+  // Per-triangle projection data (indexed like 'triangles'), stored as
+  // separate arrays so walking only touches what it needs. The barycentric
+  // coordinates of point p in triangle t are (1 - v - w, v, w) with
+  //  v = dot(p - vertices[triangles[t].x], triangle_gradient_v[t])
+  //  w = dot(p - vertices[triangles[t].x], triangle_gradient_w[t])
+  // (the gradients are the edge vectors times the inverse Gram matrix)
+  std::vector<glm::vec3> triangle_gradient_v;
+  std::vector<glm::vec3> triangle_gradient_w;
+  std::vector<glm::vec3> triangle_normals;  // unit face normals
+
+  // Bounding volume hierarchy over the triangles, used to answer closest-point
+  // queries without visiting every triangle. bvh_nodes[0] is the root; the
+  // children of an interior node are stored next to each other at 'first' and
+  // 'first + 1'; a leaf holds triangles bvh_triangles[first, first + count):
+  struct BVHNode {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+    uint32_t first = 0;
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+    uint32_t count = 0;  // 0 for interior nodes
+  };
+  static_assert(sizeof(BVHNode) == 32, "BVHNode is packed.");
+  std::vector<BVHNode> bvh_nodes;
+  std::vector<uint32_t> bvh_triangles;
+
+  // Optional grid over the xy plane, for meshes that are mostly floor: the
+  // triangles whose xy bounds overlap cell c (in column c % grid_columns, row
+  // c / grid_columns) are grid_triangles[grid_offsets[c], grid_offsets[c+1]).
+  // (empty for meshes that aren't height-field-like; see build_grid())
+  glm::vec2 grid_origin = glm::vec2(0.0f);
+  float grid_cell_size = 0.0f;
+  uint32_t grid_columns = 0;
+  uint32_t grid_rows = 0;
+  std::vector<uint32_t> grid_offsets;
+  std::vector<uint32_t> grid_triangles;
+
+  // Carving (see carve()) cuts triangles into pieces at runtime. The bvh and
+  // grid keep listing only the triangles the mesh was built with: the first
+  // piece of a cut triangle takes over its index, the rest are appended and
+  // chained from it through triangle_next_piece (-1U ends a chain), and
+  // triangles carved away entirely are flagged in triangle_removed. Every
+  // piece lies within the triangle it was cut from, so the bvh and grid
+  // bounds stay valid. (both empty until the first carve)
+  std::vector<uint32_t> triangle_next_piece;
+  std::vector<uint8_t> triangle_removed;
+  uint32_t revision = 0;  // bumped by every carve()
+
+  uint32_t next_piece(uint32_t t) const {
+    return triangle_next_piece.empty() ? -1U : triangle_next_piece[t];
+  }
+  bool removed(uint32_t t) const {
+    return !triangle_removed.empty() && triangle_removed[t];
+  }
+
+  // For meshes that are one tile of a larger mesh (see WalkTiles.hpp), bit i
+  // of triangle_borders[t] is set if edge i of triangle t lies on the tile's
+  // border; walk() stops at such edges instead of sliding along them.
+  // (empty for meshes that aren't tiles)
+  std::vector<uint8_t> triangle_borders;
+
+  // Construct new WalkMesh from file:
+  //  baked files (see save()) are memory-mapped and copied in as-is; files
+  //  written by export-walk-mesh.py only hold vtx0/tri0/nom0, so adjacency,
+  //  projection, bvh and grid structures get built here instead.
+  // note: will throw if file fails to read.
   explicit WalkMesh(std::string filename);
 
+  // Construct new WalkMesh from vertex and (CCW) triangle lists, building
+  // the rest as for an unbaked file:
+  WalkMesh(std::vector<glm::vec3> const &vertices,
+           std::vector<glm::uvec3> const &triangles,
+           std::vector<glm::vec3> const &vertex_normals);
+
+  // Write a baked walk mesh file, which holds the built structures as well:
+  // note: will throw if the mesh has been carved.
+  void save(std::string const &filename) const;
+
+  // fills in neighbors / neighbor_edges from triangles (called by
+  // constructor):
+  void build_adjacency();
+
+  // fills in the triangle_gradient_* / triangle_normals arrays (called by
+  // constructor):
+  void build_projection();
+  void project_triangle(uint32_t t);  // (just triangle t's entries)
+
+  // fills in bvh_nodes / bvh_triangles from triangles (called by constructor):
+  void build_bvh();
+
+  // fills in the grid_* members if most of the mesh's area faces up or down
+  // (called by constructor):
+  void build_grid();
+
+  // the grid cell under a point (or -1U if there's no grid or the point is
+  // outside it):
+  uint32_t grid_cell(glm::vec3 const &world_point) const {
+    if (grid_offsets.empty()) return -1U;
+    glm::vec2 cell = (glm::vec2(world_point) - grid_origin) / grid_cell_size;
+    if (!(cell.x >= 0.0f && cell.y >= 0.0f)) return -1U;
+    if (cell.x >= grid_columns || cell.y >= grid_rows) return -1U;
+    return uint32_t(cell.y) * grid_columns + uint32_t(cell.x);
+  }
+
+  // barycentric coordinates of (the projection of) a point onto the plane of
+  // triangle t:
+  glm::vec3 barycentric(uint32_t t, glm::vec3 const &point) const {
+    glm::vec3 offset = point - vertices[triangles[t].x];
+    float v = glm::dot(offset, triangle_gradient_v[t]);
+    float w = glm::dot(offset, triangle_gradient_w[t]);
+    return glm::vec3(1.0f - v - w, v, w);
+  }
+
+  // change in barycentric coordinates caused by a world-space step in
+  // triangle t:
+  glm::vec3 weights_step(uint32_t t, glm::vec3 const &step) const {
+    float v = glm::dot(step, triangle_gradient_v[t]);
+    float w = glm::dot(step, triangle_gradient_w[t]);
+    return glm::vec3(-v - w, v, w);
+  }
+
   struct WalkPoint {
-    glm::uvec3 triangle = glm::uvec3(-1U);  // indices of current triangle
+    uint32_t triangle = -1U;  // index of current triangle (in 'triangles')
     glm::vec3 weights = glm::vec3(
         std::numeric_limits<float>::quiet_NaN());  // barycentric coordinates
                                                    // for current point
@@ -40,22 +158,103 @@ struct WalkMesh {
   // (should only need to call this at the start of a level)
   WalkPoint start(glm::vec3 const &world_point) const;
 
+  // used to teleport or snap to the ground -- finds the point of the walk mesh
+  // straight above or below 'world_point' (nearest in z, if several are);
+  // with a grid this only looks at one cell. Falls back to start() if the
+  // mesh has no grid or there's no triangle above or below the point.
+  WalkPoint locate(glm::vec3 const &world_point) const;
+
+  // same as start(), for many points at once (e.g. respawning a crowd):
+  //  (walk_points is resized to match world_points)
+  void start_many(std::vector<glm::vec3> const &world_points,
+                  std::vector<WalkPoint> *walk_points) const;
+
+  // reported by walk():
+  struct WalkResult {
+    float consumed = 0.0f;   // fraction of the step's length that was used
+    uint32_t crossings = 0;  // number of edges crossed into a neighbor
+    // the unused part of the step, turned to lie in the final triangle:
+    glm::vec3 remaining = glm::vec3(0.0f);
+    // set if the walk stopped on a tile border edge (see triangle_borders):
+    //  (or on any boundary edge, for trace() without sliding)
+    uint32_t border_edge = -1U;
+  };
+
   // used to update walk point:
-  void walk(WalkPoint &wp, glm::vec3 const &step, uint32_t depth = 0) const;
+  //  the step slides along boundary edges (but stops at tile borders, see
+  //  triangle_borders). At most 'max_crossings' edges are
+  //  crossed (or slid along), so the cost of a call is bounded; whatever is
+  //  left of the step after that is dropped and shows up in 'consumed'.
+  WalkResult walk(WalkPoint &wp, glm::vec3 const &step,
+                  uint32_t max_crossings = 64) const;
+
+  // same as walk(), for many walk points at once (e.g. a crowd):
+  //  moves walk_points[i] by steps[i]; points whose step stays inside their
+  //  triangle are handled several at a time with SIMD, the rest fall back to
+  //  walk().
+  void walk_many(std::vector<glm::vec3> const &steps,
+                 std::vector<WalkPoint> *walk_points) const;
+
+  // walk() with sliding optional; without it, the walk stops at the first
+  // boundary edge it meets (and reports it in border_edge):
+  WalkResult trace(WalkPoint &wp, glm::vec3 const &step,
+                   uint32_t max_crossings, bool slide) const;
+
+  // can a walker at 'from' see 'to'?
+  //  traces the segment between them across triangles (through adjacency),
+  //  so the cost is proportional to the triangles crossed; blocked if the
+  //  segment leaves the mesh or more than 'max_crossings' edges are crossed.
+  bool line_of_sight(WalkPoint const &from, WalkPoint const &to,
+                     uint32_t max_crossings = 256) const;
+
+  // first hit of a ray with the walk mesh (uses the bvh, so the cost is
+  // proportional to the nodes and triangles the ray passes near):
+  //  returns false if nothing is hit within 'max_distance' (in units of
+  //  'direction''s length); otherwise sets 'hit' and 'hit_distance' if given.
+  bool raycast(glm::vec3 const &origin, glm::vec3 const &direction,
+               float max_distance, WalkPoint *hit,
+               float *hit_distance = nullptr) const;
+
+  // reported by carve(), to help budget carving:
+  struct CarveResult {
+    uint32_t cut = 0;      // triangles the footprint cut into
+    uint32_t split = 0;    // neighbors split to match the cut triangles' edges
+    uint32_t removed = 0;  // triangles carved away completely
+    uint32_t added = 0;    // triangles appended
+    uint32_t added_vertices = 0;
+    uint32_t moved = 0;  // walk points moved out of the carved area
+  };
+
+  // cuts a hole in the mesh, e.g. under a crate dropped on the floor:
+  //  removes the parts of triangles that overlap the convex polygon
+  //  'footprint' (in the xy plane; either winding) and the z range
+  //  [min_z, max_z]. Only the triangles under the footprint and the
+  //  neighbors sharing their edges are re-triangulated, and adjacency is
+  //  patched locally, so the cost is proportional to the area carved.
+  //  (near-vertical triangles are left alone)
+  //  Indices of untouched triangles don't change; walk points in touched
+  //  triangles are re-located if passed in 'walk_points' (other walk points
+  //  in those triangles become invalid).
+  // Carved walk meshes can't be saved; WalkPathfinder notices carving (via
+  // 'revision') on its own, but stops using its WalkClusters until given
+  // ones rebuilt for the carved mesh (see WalkPathfinder::set_clusters()).
+  CarveResult carve(std::vector<glm::vec2> const &footprint, float min_z,
+                    float max_z, std::vector<WalkPoint> *walk_points = nullptr);
 
   // used to read back results of walking:
   glm::vec3 world_point(WalkPoint const &wp) const {
-    return wp.weights.x * vertices[wp.triangle.x] +
-           wp.weights.y * vertices[wp.triangle.y] +
-           wp.weights.z * vertices[wp.triangle.z];
+    glm::uvec3 const &tri = triangles[wp.triangle];
+    return wp.weights.x * vertices[tri.x] + wp.weights.y * vertices[tri.y] +
+           wp.weights.z * vertices[tri.z];
   }
 
   glm::vec3 world_normal(WalkPoint const &wp) const {
     // TODO: could interpolate vertex_normals instead of computing the triangle
     // normal:
-    return glm::normalize(wp.weights[0] * vertex_normals[wp.triangle[0]] +
-                          wp.weights[1] * vertex_normals[wp.triangle[1]] +
-                          wp.weights[2] * vertex_normals[wp.triangle[2]]);
+    glm::uvec3 const &tri = triangles[wp.triangle];
+    return glm::normalize(wp.weights[0] * vertex_normals[tri[0]] +
+                          wp.weights[1] * vertex_normals[tri[1]] +
+                          wp.weights[2] * vertex_normals[tri[2]]);
   }
 };
 
@@ -0,0 +1,539 @@
+#include "WalkPathfinder.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+WalkPathfinder::WalkPathfinder(WalkMesh const &walk_mesh_, uint32_t cache_size,
+                               WalkClusters const *clusters_)
+    : walk_mesh(walk_mesh_) {
+  fit_triangles();
+
+  cache.resize(std::max(1U, cache_size));
+
+  set_clusters(clusters_);
+}
+
+void WalkPathfinder::set_clusters(WalkClusters const *clusters_) {
+  uint32_t count = uint32_t(walk_mesh.triangles.size());
+  if (clusters_ && (clusters_->walk_mesh_revision != walk_mesh.revision ||
+                    clusters_->triangle_clusters.size() != count)) {
+    throw std::runtime_error(
+        "Walk clusters don't match the current revision of the walk mesh.");
+  }
+
+  if (mesh_revision != walk_mesh.revision) fit_triangles();
+  clear_cache();
+  clusters = clusters_;
+
+  if (clusters) {
+    uint32_t portals = uint32_t(clusters->portal_triangles.size());
+    portal_cost.resize(portals + 1);
+    portal_came_from.resize(portals + 1);
+    portal_came_by.resize(portals + 1);
+    portal_open_stamp.assign(portals + 1, 0);
+    portal_closed_stamp.assign(portals + 1, 0);
+    // (the goal gets pushed at most once per portal reached)
+    open.reserve(3 * count + 2 * clusters->links.size() + portals + 1);
+
+    uint32_t most_portals = 0;
+    for (uint32_t c = 0; c < clusters->cluster_count; ++c) {
+      most_portals = std::max(most_portals,
+                              clusters->cluster_portal_offsets[c + 1] -
+                                  clusters->cluster_portal_offsets[c]);
+    }
+    goal_costs.reserve(most_portals);
+  }
+}
+
+void WalkPathfinder::fit_triangles() {
+  uint32_t count = uint32_t(walk_mesh.triangles.size());
+  mesh_revision = walk_mesh.revision;
+
+  centroids.resize(count);
+  for (uint32_t t = 0; t < count; ++t) {
+    glm::uvec3 const &tri = walk_mesh.triangles[t];
+    centroids[t] = (walk_mesh.vertices[tri.x] + walk_mesh.vertices[tri.y] +
+                    walk_mesh.vertices[tri.z]) /
+                   3.0f;
+  }
+  cost.resize(count);
+  came_from.resize(count);
+  open_stamp.assign(count, 0);
+  closed_stamp.assign(count, 0);
+  search_stamp = 0;
+
+  // each triangle is pushed at most once per incoming edge:
+  open.reserve(3 * count + 1);
+}
+
+void WalkPathfinder::clear_cache() {
+  for (auto &entry : cache) {
+    entry.start = entry.goal = -1U;
+    entry.last_used = 0;
+  }
+}
+
+bool WalkPathfinder::find_path(WalkMesh::WalkPoint const &from,
+                               WalkMesh::WalkPoint const &to,
+                               std::vector<glm::vec3> *path_) {
+  assert(path_);
+  auto &path = *path_;
+  path.clear();
+
+  // carving renumbers and adds triangles, so corridors (and clusters, which
+  // can't be patched; see set_clusters()) go stale:
+  if (mesh_revision != walk_mesh.revision) {
+    fit_triangles();
+    clear_cache();
+    clusters = nullptr;
+  }
+
+  glm::vec3 start_point = walk_mesh.world_point(from);
+  glm::vec3 goal_point = walk_mesh.world_point(to);
+
+  // look for the corridor in the cache, or else pick the least-recently-used
+  // entry to replace:
+  ++cache_clock;
+  CacheEntry *found = nullptr;
+  CacheEntry *oldest = &cache[0];
+  for (auto &entry : cache) {
+    if (entry.last_used != 0 && entry.start == from.triangle &&
+        entry.goal == to.triangle) {
+      found = &entry;
+      break;
+    }
+    if (entry.last_used < oldest->last_used) oldest = &entry;
+  }
+
+  if (found) {
+    ++cache_hits;
+  } else {
+    ++cache_misses;
+    found = oldest;
+    found->start = from.triangle;
+    found->goal = to.triangle;
+    // long routes go through the cluster graph, unless both ends are in the
+    // same cluster and the route can stay inside it.
+    // (unreachable pairs are cached too, as an empty corridor)
+    bool routed = false;
+    if (!clusters) {
+      routed = search(from.triangle, start_point, to.triangle, goal_point,
+                      -1U, &found->corridor);
+    } else {
+      uint32_t cluster = clusters->triangle_clusters[from.triangle];
+      if (cluster == clusters->triangle_clusters[to.triangle]) {
+        routed = search(from.triangle, start_point, to.triangle, goal_point,
+                        cluster, &found->corridor);
+      }
+      if (!routed) {
+        routed = search_clusters(from.triangle, start_point, to.triangle,
+                                 goal_point, &found->corridor);
+      }
+    }
+    if (!routed) found->corridor.clear();
+  }
+  found->last_used = cache_clock;
+
+  if (found->corridor.empty()) return false;
+
+  funnel(found->corridor, from, to, &path);
+  return true;
+}
+
+bool WalkPathfinder::search(uint32_t start, glm::vec3 const &start_point,
+                            uint32_t goal, glm::vec3 const &goal_point,
+                            uint32_t cluster,
+                            std::vector<uint32_t> *corridor_) {
+  assert(corridor_ || goal == -1U);
+  assert(clusters || cluster == -1U);
+
+  ++search_stamp;
+  if (search_stamp == 0) {
+    // stamps wrapped around, so old entries might look current:
+    std::fill(open_stamp.begin(), open_stamp.end(), 0);
+    std::fill(closed_stamp.begin(), closed_stamp.end(), 0);
+    search_stamp = 1;
+  }
+
+  // (std heap functions build a max-heap, so compare backwards)
+  auto later = [](std::pair<float, uint32_t> const &a,
+                  std::pair<float, uint32_t> const &b) {
+    return a.first > b.first;
+  };
+
+  // distance between triangles is measured centroid-to-centroid, except that
+  // the start triangle is measured from the actual start point:
+  auto position = [&](uint32_t t) {
+    return (t == start ? start_point : centroids[t]);
+  };
+
+  // (flooding is plain Dijkstra, so there's no estimate to add)
+  auto estimate = [&](glm::vec3 const &from) {
+    return (goal == -1U ? 0.0f : glm::distance(from, goal_point));
+  };
+
+  open.clear();
+  cost[start] = 0.0f;
+  came_from[start] = -1U;
+  open_stamp[start] = search_stamp;
+  open.emplace_back(estimate(start_point), start);
+
+  while (!open.empty()) {
+    std::pop_heap(open.begin(), open.end(), later);
+    uint32_t at = open.back().second;
+    open.pop_back();
+
+    // skip stale entries left behind when a cheaper route was found:
+    if (closed_stamp[at] == search_stamp) continue;
+    closed_stamp[at] = search_stamp;
+
+    if (at == goal) {
+      auto &corridor = *corridor_;
+      corridor.clear();
+      for (uint32_t t = goal; t != -1U; t = came_from[t]) {
+        corridor.emplace_back(t);
+      }
+      std::reverse(corridor.begin(), corridor.end());
+      return true;
+    }
+
+    glm::uvec3 const &next = walk_mesh.neighbors[at];
+    for (uint32_t i = 0; i < 3; ++i) {
+      uint32_t n = next[i];
+      if (n == -1U || closed_stamp[n] == search_stamp) continue;
+      if (cluster != -1U && clusters->triangle_clusters[n] != cluster) continue;
+      glm::vec3 n_position = (n == goal ? goal_point : centroids[n]);
+      float n_cost = cost[at] + glm::distance(position(at), n_position);
+      if (open_stamp[n] == search_stamp && cost[n] <= n_cost) continue;
+      open_stamp[n] = search_stamp;
+      cost[n] = n_cost;
+      came_from[n] = at;
+      open.emplace_back(n_cost + estimate(n_position), n);
+      std::push_heap(open.begin(), open.end(), later);
+    }
+  }
+
+  return false;
+}
+
+float WalkPathfinder::cost_to_portal(uint32_t start, glm::vec3 const &point,
+                                     uint32_t p, uint32_t c) const {
+  uint32_t side = clusters->portal_side(p, c);
+  if (closed_stamp[side] != search_stamp) {
+    return std::numeric_limits<float>::infinity();
+  }
+  return cost[side] + glm::distance((side == start ? point : centroids[side]),
+                                    clusters->portal_midpoints[p]);
+}
+
+bool WalkPathfinder::search_clusters(uint32_t start,
+                                     glm::vec3 const &start_point,
+                                     uint32_t goal, glm::vec3 const &goal_point,
+                                     std::vector<uint32_t> *corridor_) {
+  assert(clusters);
+  assert(corridor_);
+  auto &corridor = *corridor_;
+  corridor.clear();
+
+  uint32_t start_cluster = clusters->triangle_clusters[start];
+  uint32_t goal_cluster = clusters->triangle_clusters[goal];
+  uint32_t const *goal_portals =
+      clusters->cluster_portals.data() +
+      clusters->cluster_portal_offsets[goal_cluster];
+  uint32_t goal_portal_count =
+      clusters->cluster_portal_offsets[goal_cluster + 1] -
+      clusters->cluster_portal_offsets[goal_cluster];
+
+  // costs between the goal and the portals around its cluster (walking costs
+  // are symmetric, so flood outward from the goal):
+  search(goal, goal_point, -1U, goal_point, goal_cluster, nullptr);
+  goal_costs.clear();
+  for (uint32_t k = 0; k < goal_portal_count; ++k) {
+    goal_costs.emplace_back(
+        cost_to_portal(goal, goal_point, goal_portals[k], goal_cluster));
+  }
+
+  // costs from the start to the portals around its cluster; this flood's
+  // state is kept to trace the start of the corridor afterward:
+  search(start, start_point, -1U, goal_point, start_cluster, nullptr);
+
+  ++portal_stamp;
+  if (portal_stamp == 0) {
+    std::fill(portal_open_stamp.begin(), portal_open_stamp.end(), 0);
+    std::fill(portal_closed_stamp.begin(), portal_closed_stamp.end(), 0);
+    portal_stamp = 1;
+  }
+
+  auto later = [](std::pair<float, uint32_t> const &a,
+                  std::pair<float, uint32_t> const &b) {
+    return a.first > b.first;
+  };
+
+  uint32_t const goal_node = uint32_t(clusters->portal_triangles.size());
+  open.clear();
+
+  // reaching portal p at 'p_cost' having come from 'from' by link 'by':
+  auto reach = [&](uint32_t p, float p_cost, uint32_t from, uint32_t by) {
+    if (portal_closed_stamp[p] == portal_stamp) return;
+    if (portal_open_stamp[p] == portal_stamp && portal_cost[p] <= p_cost) {
+      return;
+    }
+    portal_open_stamp[p] = portal_stamp;
+    portal_cost[p] = p_cost;
+    portal_came_from[p] = from;
+    portal_came_by[p] = by;
+    float estimate = 0.0f;
+    if (p != goal_node) {
+      estimate = glm::distance(clusters->portal_midpoints[p], goal_point);
+    }
+    open.emplace_back(p_cost + estimate, p);
+    std::push_heap(open.begin(), open.end(), later);
+  };
+
+  for (uint32_t o = clusters->cluster_portal_offsets[start_cluster];
+       o < clusters->cluster_portal_offsets[start_cluster + 1]; ++o) {
+    uint32_t p = clusters->cluster_portals[o];
+    float p_cost = cost_to_portal(start, start_point, p, start_cluster);
+    if (p_cost != std::numeric_limits<float>::infinity()) {
+      reach(p, p_cost, -1U, -1U);
+    }
+  }
+
+  bool found = false;
+  while (!open.empty()) {
+    std::pop_heap(open.begin(), open.end(), later);
+    uint32_t at = open.back().second;
+    open.pop_back();
+
+    if (portal_closed_stamp[at] == portal_stamp) continue;
+    portal_closed_stamp[at] = portal_stamp;
+
+    if (at == goal_node) {
+      found = true;
+      break;
+    }
+
+    // portals around the goal cluster lead to the goal itself:
+    for (uint32_t k = 0; k < goal_portal_count; ++k) {
+      if (goal_portals[k] == at &&
+          goal_costs[k] != std::numeric_limits<float>::infinity()) {
+        reach(goal_node, portal_cost[at] + goal_costs[k], at, -1U);
+      }
+    }
+
+    for (uint32_t l = clusters->link_offsets[at];
+         l < clusters->link_offsets[at + 1]; ++l) {
+      WalkClusters::Link const &link = clusters->links[l];
+      reach(link.portal, portal_cost[at] + link.cost, at, l);
+    }
+  }
+  if (!found) return false;
+
+  portal_route.clear();
+  for (uint32_t p = portal_came_from[goal_node]; p != -1U;
+       p = portal_came_from[p]) {
+    portal_route.emplace_back(p);
+  }
+  std::reverse(portal_route.begin(), portal_route.end());
+
+  // stitch the corridor together: the start flood's trail to the first
+  // portal, then the stored corridor of each link, then a search from the
+  // last portal to the goal. Consecutive pieces may share a triangle when a
+  // link stays in the start or goal cluster, so skip repeats:
+  auto append = [&corridor](uint32_t t) {
+    if (corridor.empty() || corridor.back() != t) corridor.emplace_back(t);
+  };
+
+  for (uint32_t t = clusters->portal_side(portal_route[0], start_cluster);
+       t != -1U; t = came_from[t]) {
+    corridor.emplace_back(t);
+  }
+  std::reverse(corridor.begin(), corridor.end());
+
+  for (uint32_t r = 1; r < portal_route.size(); ++r) {
+    WalkClusters::Link const &link =
+        clusters->links[portal_came_by[portal_route[r]]];
+    for (uint32_t c = 0; c < link.corridor_count; ++c) {
+      append(clusters->link_corridors[link.corridor_first + c]);
+    }
+  }
+
+  uint32_t last = portal_route.back();
+  if (!search(clusters->portal_side(last, goal_cluster),
+              clusters->portal_midpoints[last], goal, goal_point,
+              goal_cluster, &goal_corridor)) {
+    return false;
+  }
+  for (uint32_t t : goal_corridor) append(t);
+
+  return true;
+}
+
+// twice the signed area of triangle (a, b, c); positive when c is to the
+// right of the line from a to b:
+static float triarea2(glm::vec2 const &a, glm::vec2 const &b,
+                      glm::vec2 const &c) {
+  glm::vec2 ab = b - a;
+  glm::vec2 ac = c - a;
+  return ac.x * ab.y - ab.x * ac.y;
+}
+
+void WalkPathfinder::funnel(std::vector<uint32_t> const &corridor,
+                            WalkMesh::WalkPoint const &from,
+                            WalkMesh::WalkPoint const &to,
+                            std::vector<glm::vec3> *path_) {
+  assert(path_);
+  auto &path = *path_;
+
+  auto const &vertices = walk_mesh.vertices;
+  auto const &triangles = walk_mesh.triangles;
+
+  // lay the first triangle flat, in a frame where CCW stays CCW:
+  glm::vec2 flat[3];
+  {
+    uint32_t t = corridor[0];
+    glm::uvec3 const &tri = triangles[t];
+    glm::vec3 x = glm::normalize(vertices[tri.y] - vertices[tri.x]);
+    glm::vec3 y = glm::cross(walk_mesh.triangle_normals[t], x);
+    for (uint32_t k = 0; k < 3; ++k) {
+      glm::vec3 offset = vertices[tri[k]] - vertices[tri.x];
+      flat[k] = glm::vec2(glm::dot(offset, x), glm::dot(offset, y));
+    }
+  }
+
+  portals.clear();
+  {
+    Portal start;
+    start.left = start.right =
+        from.weights.x * flat[0] + from.weights.y * flat[1] +
+        from.weights.z * flat[2];
+    start.left_world = start.right_world = walk_mesh.world_point(from);
+    portals.emplace_back(start);
+  }
+
+  // gather the portals between consecutive corridor triangles, unfolding each
+  // triangle across the portal as it goes. Triangles are CCW, so walking out
+  // through edge i (opposite vertex i) of a triangle, the vertex after i is on
+  // the right and the one after that is on the left:
+  for (uint32_t c = 0; c + 1 < corridor.size(); ++c) {
+    uint32_t t = corridor[c];
+    uint32_t n = corridor[c + 1];
+    glm::uvec3 const &next = walk_mesh.neighbors[t];
+    uint32_t i = (next.x == n ? 0 : (next.y == n ? 1 : 2));
+    glm::uvec3 const &tri = triangles[t];
+
+    Portal portal;
+    portal.left = flat[(i + 2) % 3];
+    portal.right = flat[(i + 1) % 3];
+    portal.left_world = vertices[tri[(i + 2) % 3]];
+    portal.right_world = vertices[tri[(i + 1) % 3]];
+    portal.fold = glm::dot(walk_mesh.triangle_normals[t],
+                           walk_mesh.triangle_normals[n]) < 0.9999f;
+    portals.emplace_back(portal);
+
+    // the neighbor runs the shared edge the other way, so its vertex after j
+    // is our left and the one after that is our right; its remaining vertex
+    // goes on the far side of the portal, at the same place along and away
+    // from the edge as on the mesh:
+    uint32_t j = walk_mesh.neighbor_edges[t][i];
+    glm::vec3 edge = portal.left_world - portal.right_world;
+    glm::vec3 offset = vertices[triangles[n][j]] - portal.right_world;
+    float along = glm::dot(offset, edge) / glm::length2(edge);
+    float away = glm::length(offset - along * edge);
+    glm::vec2 flat_edge = portal.left - portal.right;
+    flat[(j + 1) % 3] = portal.left;
+    flat[(j + 2) % 3] = portal.right;
+    flat[j] = portal.right + along * flat_edge +
+              away * glm::normalize(glm::vec2(flat_edge.y, -flat_edge.x));
+  }
+
+  {
+    Portal goal;
+    goal.left = goal.right = to.weights.x * flat[0] + to.weights.y * flat[1] +
+                             to.weights.z * flat[2];
+    goal.left_world = goal.right_world = walk_mesh.world_point(to);
+    portals.emplace_back(goal);
+  }
+
+  // pull the string through the unfolded portals:
+  corners.clear();
+  glm::vec2 apex = portals[0].left;
+  glm::vec2 left = apex;
+  glm::vec2 right = apex;
+  uint32_t apex_index = 0;
+  uint32_t left_index = 0;
+  uint32_t right_index = 0;
+
+  for (uint32_t i = 1; i < portals.size(); ++i) {
+    glm::vec2 const &new_left = portals[i].left;
+    glm::vec2 const &new_right = portals[i].right;
+
+    // try to narrow the funnel from the right:
+    if (triarea2(apex, right, new_right) <= 0.0f) {
+      if (apex == right || triarea2(apex, left, new_right) > 0.0f) {
+        right = new_right;
+        right_index = i;
+      } else {
+        // the right side crossed over the left, so the left is a corner:
+        corners.push_back(
+            Corner{left_index, left, portals[left_index].left_world});
+        apex = right = left;
+        apex_index = right_index = left_index;
+        i = apex_index;
+        continue;
+      }
+    }
+
+    // try to narrow the funnel from the left:
+    if (triarea2(apex, left, new_left) >= 0.0f) {
+      if (apex == left || triarea2(apex, right, new_left) < 0.0f) {
+        left = new_left;
+        left_index = i;
+      } else {
+        // the left side crossed over the right, so the right is a corner:
+        corners.push_back(
+            Corner{right_index, right, portals[right_index].right_world});
+        apex = left = right;
+        apex_index = left_index = right_index;
+        i = apex_index;
+        continue;
+      }
+    }
+  }
+  {
+    uint32_t last = uint32_t(portals.size()) - 1;
+    corners.push_back(
+        Corner{last, portals[last].left, portals[last].left_world});
+  }
+
+  // walk the corners, adding a waypoint wherever a straight (unfolded) segment
+  // crosses a folded portal:
+  path.emplace_back(portals[0].left_world);
+  auto add = [&path](glm::vec3 const &point) {
+    if (glm::length2(point - path.back()) > 1e-10f) path.emplace_back(point);
+  };
+  uint32_t from_portal = 0;
+  glm::vec2 from_at = portals[0].left;
+  for (auto const &corner : corners) {
+    glm::vec2 along = corner.at - from_at;
+    for (uint32_t i = from_portal + 1; i < corner.portal; ++i) {
+      Portal const &portal = portals[i];
+      if (!portal.fold) continue;
+      // where the segment crosses the line through the portal, as a fraction
+      // of the way from its right end to its left end:
+      glm::vec2 edge = portal.left - portal.right;
+      glm::vec2 offset = from_at - portal.right;
+      float denom = edge.x * along.y - edge.y * along.x;
+      float amt = 0.5f;
+      if (denom != 0.0f) {
+        amt = (offset.x * along.y - offset.y * along.x) / denom;
+        amt = std::max(0.0f, std::min(1.0f, amt));
+      }
+      add(glm::mix(portal.right_world, portal.left_world, amt));
+    }
+    add(corner.world);
+    from_portal = corner.portal;
+    from_at = corner.at;
+  }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "WalkClusters.hpp"
+#include "WalkMesh.hpp"
+
+#include <vector>
+
+// "WalkPathfinder" routes walk points across a WalkMesh:
+//  A* over the triangle adjacency graph finds a corridor of triangles, then
+//  string-pulling (the "simple stupid funnel algorithm") turns the corridor
+//  into a short list of waypoints.
+// The walk mesh isn't flat (it curls up the walls), so the corridor is
+// unfolded into the plane of its first triangle before pulling the string;
+// the path gets an extra waypoint wherever it crosses a fold, so every
+// segment of it lies on the surface.
+// All search storage is allocated up front, so queries don't allocate once
+// the scratch vectors have grown to fit the longest corridor. Corridors are
+// kept in a small LRU cache keyed by (start, goal) triangle, since many agents
+// head for the same few places.
+// Given WalkClusters for the mesh, routes between clusters are found on the
+// cluster portal graph, and triangles are only searched in the start and goal
+// clusters.
+
+struct WalkPathfinder {
+  // note: will throw if 'clusters' were made for another revision of the walk
+  // mesh (see set_clusters()).
+  explicit WalkPathfinder(WalkMesh const &walk_mesh, uint32_t cache_size = 16,
+                          WalkClusters const *clusters = nullptr);
+
+  // finds a path from 'from' to 'to':
+  //  returns false (and leaves 'path' empty) if 'to' can't be reached.
+  //  'path' gets world-space waypoints, starting at 'from' and ending at 'to'.
+  bool find_path(WalkMesh::WalkPoint const &from,
+                 WalkMesh::WalkPoint const &to, std::vector<glm::vec3> *path);
+
+  // forget all cached corridors (e.g. after the walk mesh changes):
+  //  (carving the walk mesh is noticed through WalkMesh::revision, and also
+  //  drops 'clusters', since they no longer match the triangles)
+  void clear_cache();
+
+  // route through 'clusters' from now on (or, if null, search triangles
+  // only). Carving drops the clusters in use, so callers carving a mesh they
+  // route long distances on should build new WalkClusters for the carved mesh
+  // and pass them in here afterward.
+  // note: will throw if 'clusters' weren't made for the walk mesh's current
+  // revision.
+  void set_clusters(WalkClusters const *clusters);
+
+  WalkMesh const &walk_mesh;
+  WalkClusters const *clusters = nullptr;  // (may be null)
+
+  // statistics, handy for tuning cache_size:
+  uint32_t cache_hits = 0;
+  uint32_t cache_misses = 0;
+
+  //------ internals ------
+
+  // A* over triangles; fills 'corridor' with the triangles from start to goal.
+  //  with cluster != -1U, only triangles in that cluster are searched.
+  //  with goal == -1U, floods the whole (cluster), leaving costs to every
+  //  triangle reached in 'cost' (and returns false).
+  bool search(uint32_t start, glm::vec3 const &start_point, uint32_t goal,
+              glm::vec3 const &goal_point, uint32_t cluster,
+              std::vector<uint32_t> *corridor);
+
+  // A* over the cluster portal graph, for start and goal in different
+  // clusters (or ones only joined through other clusters):
+  bool search_clusters(uint32_t start, glm::vec3 const &start_point,
+                       uint32_t goal, glm::vec3 const &goal_point,
+                       std::vector<uint32_t> *corridor);
+
+  // cost of walking from 'point' (in triangle 'start') to portal p, after a
+  // flood from 'start' within cluster c; infinite if not reached:
+  float cost_to_portal(uint32_t start, glm::vec3 const &point, uint32_t p,
+                       uint32_t c) const;
+
+  // string-pulls a corridor into waypoints:
+  void funnel(std::vector<uint32_t> const &corridor,
+              WalkMesh::WalkPoint const &from, WalkMesh::WalkPoint const &to,
+              std::vector<glm::vec3> *path);
+
+  // sizes the per-triangle state to the walk mesh, as of 'mesh_revision':
+  void fit_triangles();
+  uint32_t mesh_revision = 0;
+
+  // per-triangle search state; entries are only valid if their stamp matches
+  // 'search_stamp', so nothing needs clearing between searches:
+  std::vector<glm::vec3> centroids;
+  std::vector<float> cost;
+  std::vector<uint32_t> came_from;
+  std::vector<uint32_t> open_stamp;
+  std::vector<uint32_t> closed_stamp;
+  uint32_t search_stamp = 0;
+
+  // open list as a binary heap of (estimated total cost, triangle):
+  std::vector<std::pair<float, uint32_t>> open;
+
+  // per-portal search state for search_clusters(), stamped the same way; the
+  // goal is an extra node after the last portal:
+  std::vector<float> portal_cost;
+  std::vector<uint32_t> portal_came_from;
+  std::vector<uint32_t> portal_came_by;  // index into clusters->links
+  std::vector<uint32_t> portal_open_stamp;
+  std::vector<uint32_t> portal_closed_stamp;
+  uint32_t portal_stamp = 0;
+  std::vector<float> goal_costs;  // from the goal cluster's portals
+  std::vector<uint32_t> portal_route;
+  std::vector<uint32_t> goal_corridor;
+
+  // portals along a corridor, with left and right as seen walking through
+  // it; portal 0 is the start point and the last portal is the goal point:
+  struct Portal {
+    glm::vec2 left, right;              // unfolded
+    glm::vec3 left_world, right_world;  // on the walk mesh
+    bool fold = false;  // do the triangles on either side differ in normal?
+  };
+  std::vector<Portal> portals;
+
+  // corners of the string-pulled path, by the portal they sit on:
+  struct Corner {
+    uint32_t portal;
+    glm::vec2 at;
+    glm::vec3 world;
+  };
+  std::vector<Corner> corners;
+
+  struct CacheEntry {
+    uint32_t start = -1U;
+    uint32_t goal = -1U;
+    uint32_t last_used = 0;  // 0 for unused entries
+    std::vector<uint32_t> corridor;
+  };
+  std::vector<CacheEntry> cache;
+  uint32_t cache_clock = 0;
+};
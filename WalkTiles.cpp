@@ -0,0 +1,396 @@
+#include "WalkTiles.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+// Tile index files start with a "wtil" chunk holding the format version and
+// the grid's column and row counts:
+static const uint32_t TilesVersion = 2;
+
+// order of WalkTiles::links:
+static bool link_less(WalkTiles::Link const &a, WalkTiles::Link const &b) {
+  if (a.tile != b.tile) return a.tile < b.tile;
+  if (a.triangle != b.triangle) return a.triangle < b.triangle;
+  return a.edge < b.edge;
+}
+
+WalkTiles::WalkTiles(std::string const &filename_) : filename(filename_) {
+  MappedFile file(filename);
+  size_t offset = 0;
+
+  std::vector<uint32_t> header;
+  file.read_chunk(&offset, "wtil", &header);
+  if (header.size() != 3 || header[0] != TilesVersion) {
+    throw std::runtime_error("Walk tiles '" + filename +
+                             "' were written with a different format version.");
+  }
+  columns = header[1];
+  rows = header[2];
+
+  std::vector<float> grid;
+  file.read_chunk(&offset, "tgd0", &grid);
+  if (grid.size() != 3) {
+    throw std::runtime_error("Walk tiles '" + filename + "' have a bad grid.");
+  }
+  origin = glm::vec2(grid[0], grid[1]);
+  tile_size = grid[2];
+
+  std::vector<uint8_t> exists;
+  file.read_chunk(&offset, "tex0", &exists);
+  std::vector<glm::vec3> bounds;
+  file.read_chunk(&offset, "tbd0", &bounds);
+  file.read_chunk(&offset, "tlk0", &links);
+  if (exists.size() != uint64_t(columns) * rows ||
+      bounds.size() != 2 * exists.size()) {
+    throw std::runtime_error("Walk tiles '" + filename +
+                             "' have mismatched chunk sizes.");
+  }
+
+  tiles.resize(exists.size());
+  for (uint32_t t = 0; t < tiles.size(); ++t) {
+    tiles[t].exists = (exists[t] != 0);
+    tiles[t].min = bounds[2 * t];
+    tiles[t].max = bounds[2 * t + 1];
+  }
+
+  // walk() follows links without checks (and looks them up with
+  // lower_bound), so make sure a damaged file can't send it astray; triangle
+  // indices are checked as tiles load (see check_links()):
+  auto bad_link = [this](char const *what) {
+    return std::runtime_error("Walk tiles '" + filename + "' have " + what +
+                              ".");
+  };
+  auto is_tile = [this](uint32_t t) {
+    return t < tiles.size() && tiles[t].exists;
+  };
+  for (uint32_t i = 0; i < links.size(); ++i) {
+    Link const &link = links[i];
+    if (!is_tile(link.tile) || !is_tile(link.next_tile)) {
+      throw bad_link("a link to a missing tile");
+    }
+    if (link.edge >= 3 || link.next_edge >= 3) {
+      throw bad_link("a link with an out-of-range edge");
+    }
+    if (i > 0 && !link_less(links[i - 1], link)) {
+      throw bad_link("links out of order");
+    }
+  }
+}
+
+std::string WalkTiles::tile_filename(std::string const &filename,
+                                     uint32_t tile) {
+  return filename + "." + std::to_string(tile);
+}
+
+void WalkTiles::split(WalkMesh const &walk_mesh, float tile_size,
+                      std::string const &filename) {
+  uint32_t count = uint32_t(walk_mesh.triangles.size());
+
+  // triangles go in the tile that holds their centroid:
+  std::vector<glm::vec2> centroids(count);
+  glm::vec2 min = glm::vec2(std::numeric_limits<float>::infinity());
+  glm::vec2 max = glm::vec2(-std::numeric_limits<float>::infinity());
+  for (uint32_t t = 0; t < count; ++t) {
+    glm::uvec3 const &tri = walk_mesh.triangles[t];
+    glm::vec3 centroid =
+        (walk_mesh.vertices[tri.x] + walk_mesh.vertices[tri.y] +
+         walk_mesh.vertices[tri.z]) /
+        3.0f;
+    centroids[t] = glm::vec2(centroid);
+    min = glm::min(min, centroids[t]);
+    max = glm::max(max, centroids[t]);
+  }
+  glm::vec2 origin = glm::floor(min / tile_size) * tile_size;
+  uint32_t columns = uint32_t((max.x - origin.x) / tile_size) + 1;
+  uint32_t rows = uint32_t((max.y - origin.y) / tile_size) + 1;
+
+  // sort triangles by tile, keeping their order within each tile:
+  std::vector<uint32_t> triangle_tiles(count);
+  std::vector<uint32_t> tile_offsets(columns * rows + 1, 0);
+  for (uint32_t t = 0; t < count; ++t) {
+    glm::vec2 cell = (centroids[t] - origin) / tile_size;
+    uint32_t column = std::min(columns - 1, uint32_t(cell.x));
+    uint32_t row = std::min(rows - 1, uint32_t(cell.y));
+    triangle_tiles[t] = row * columns + column;
+    tile_offsets[triangle_tiles[t] + 1] += 1;
+  }
+  for (uint32_t i = 1; i < tile_offsets.size(); ++i) {
+    tile_offsets[i] += tile_offsets[i - 1];
+  }
+  std::vector<uint32_t> tile_triangles(count);
+  std::vector<uint32_t> local_index(count);
+  {
+    std::vector<uint32_t> fill(tile_offsets.begin(), tile_offsets.end() - 1);
+    for (uint32_t t = 0; t < count; ++t) {
+      uint32_t tile = triangle_tiles[t];
+      local_index[t] = fill[tile] - tile_offsets[tile];
+      tile_triangles[fill[tile]++] = t;
+    }
+  }
+
+  // write each tile as a baked walk mesh, flagging and linking border edges:
+  std::vector<Link> links;
+  std::vector<uint8_t> exists(columns * rows, 0);
+  std::vector<glm::vec3> bounds(2 * columns * rows, glm::vec3(0.0f));
+  std::vector<uint32_t> vertex_map(walk_mesh.vertices.size(), -1U);
+  for (uint32_t tile = 0; tile < columns * rows; ++tile) {
+    uint32_t begin = tile_offsets[tile];
+    uint32_t end = tile_offsets[tile + 1];
+    if (begin == end) continue;
+    exists[tile] = 1;
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::uvec3> triangles;
+    for (uint32_t i = begin; i < end; ++i) {
+      glm::uvec3 const &tri = walk_mesh.triangles[tile_triangles[i]];
+      glm::uvec3 local;
+      for (uint32_t k = 0; k < 3; ++k) {
+        if (vertex_map[tri[k]] == -1U) {
+          vertex_map[tri[k]] = uint32_t(vertices.size());
+          vertices.emplace_back(walk_mesh.vertices[tri[k]]);
+          normals.emplace_back(walk_mesh.vertex_normals[tri[k]]);
+        }
+        local[k] = vertex_map[tri[k]];
+      }
+      triangles.emplace_back(local);
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+      glm::uvec3 const &tri = walk_mesh.triangles[tile_triangles[i]];
+      for (uint32_t k = 0; k < 3; ++k) vertex_map[tri[k]] = -1U;
+    }
+
+    bounds[2 * tile] = glm::vec3(std::numeric_limits<float>::infinity());
+    bounds[2 * tile + 1] = glm::vec3(-std::numeric_limits<float>::infinity());
+    for (auto const &v : vertices) {
+      bounds[2 * tile] = glm::min(bounds[2 * tile], v);
+      bounds[2 * tile + 1] = glm::max(bounds[2 * tile + 1], v);
+    }
+
+    // (triangles keep their vertex order, so edge indices carry over)
+    WalkMesh mesh(vertices, triangles, normals);
+    mesh.triangle_borders.assign(triangles.size(), 0);
+    for (uint32_t i = begin; i < end; ++i) {
+      uint32_t t = tile_triangles[i];
+      for (uint32_t e = 0; e < 3; ++e) {
+        uint32_t n = walk_mesh.neighbors[t][e];
+        if (n == -1U || triangle_tiles[n] == tile) continue;
+        mesh.triangle_borders[i - begin] |= uint8_t(1 << e);
+        links.emplace_back(Link{tile, i - begin, e, triangle_tiles[n],
+                                local_index[n],
+                                walk_mesh.neighbor_edges[t][e]});
+      }
+    }
+    mesh.save(tile_filename(filename, tile));
+  }
+
+  std::ofstream file(filename, std::ios::binary);
+  write_chunk(file, "wtil", std::vector<uint32_t>{TilesVersion, columns, rows});
+  write_chunk(file, "tgd0", std::vector<float>{origin.x, origin.y, tile_size});
+  write_chunk(file, "tex0", exists);
+  write_chunk(file, "tbd0", bounds);
+  write_chunk(file, "tlk0", links);
+}
+
+uint32_t WalkTiles::tile_at(glm::vec3 const &point) const {
+  glm::vec2 cell = (glm::vec2(point) - origin) / tile_size;
+  if (!(cell.x >= 0.0f && cell.y >= 0.0f)) return -1U;
+  uint32_t column = uint32_t(cell.x);
+  uint32_t row = uint32_t(cell.y);
+  if (column >= columns || row >= rows) return -1U;
+  return row * columns + column;
+}
+
+void WalkTiles::check_links(uint32_t t, WalkMesh const &mesh) const {
+  uint32_t count = uint32_t(mesh.triangles.size());
+  for (Link const &link : links) {
+    if ((link.tile == t && link.triangle >= count) ||
+        (link.next_tile == t && link.next_triangle >= count)) {
+      throw std::runtime_error("Walk tiles '" + filename +
+                               "' have a link to an out-of-range triangle in "
+                               "tile " + std::to_string(t) + ".");
+    }
+  }
+}
+
+WalkMesh const &WalkTiles::require(uint32_t t) {
+  Tile &tile = tiles[t];
+  assert(tile.exists);
+  if (!tile.mesh) {
+    // (tiles still loading are already resident)
+    bool was_loading = tile.loading.valid();
+    std::unique_ptr<WalkMesh> mesh;
+    if (was_loading) {
+      mesh = tile.loading.get();
+    } else {
+      mesh.reset(new WalkMesh(tile_filename(filename, t)));
+    }
+    check_links(t, *mesh);
+    tile.mesh = std::move(mesh);
+    if (!was_loading) resident.emplace_back(t);
+  }
+  tile.last_needed = frame;
+  return *tile.mesh;
+}
+
+WalkTiles::TilePoint WalkTiles::start(glm::vec3 const &world_point) {
+  // squared distance from the point to tile t's bounds (a lower bound on the
+  // distance to any of its triangles):
+  auto box_distance2 = [this, &world_point](uint32_t t) {
+    glm::vec3 closest = glm::clamp(world_point, tiles[t].min, tiles[t].max);
+    return glm::length2(closest - world_point);
+  };
+
+  // start with the tile under the point, or else the one with the nearest
+  // bounds:
+  uint32_t first = tile_at(world_point);
+  if (first == -1U || !tiles[first].exists) {
+    first = -1U;
+    float best = std::numeric_limits<float>::infinity();
+    for (uint32_t t = 0; t < tiles.size(); ++t) {
+      if (!tiles[t].exists) continue;
+      float dis2 = box_distance2(t);
+      if (dis2 < best) {
+        best = dis2;
+        first = t;
+      }
+    }
+  }
+  if (first == -1U) {
+    throw std::runtime_error("Walk tiles '" + filename + "' are empty.");
+  }
+
+  TilePoint tp;
+  tp.tile = first;
+  tp.point = require(first).start(world_point);
+  float best = glm::length2(tiles[first].mesh->world_point(tp.point) -
+                            world_point);
+
+  // triangles can stick out of their tile's cell, so a closer point may be in
+  // any tile whose bounds come nearer than the one found so far:
+  for (uint32_t t = 0; t < tiles.size(); ++t) {
+    if (t == first || !tiles[t].exists || !(box_distance2(t) < best)) {
+      continue;
+    }
+    WalkMesh const &mesh = require(t);
+    WalkMesh::WalkPoint point = mesh.start(world_point);
+    float dis2 = glm::length2(mesh.world_point(point) - world_point);
+    if (dis2 < best) {
+      best = dis2;
+      tp.tile = t;
+      tp.point = point;
+    }
+  }
+  return tp;
+}
+
+WalkMesh::WalkResult WalkTiles::walk(TilePoint &tp, glm::vec3 const &step,
+                                     uint32_t max_crossings) {
+  WalkMesh::WalkResult result;
+  float step_length = glm::length(step);
+  if (step_length == 0.0f) {
+    result.consumed = 1.0f;
+    return result;
+  }
+
+  WalkMesh const *mesh = &require(tp.tile);
+  glm::vec3 remaining = step;
+  while (true) {
+    WalkMesh::WalkResult part =
+        mesh->walk(tp.point, remaining, max_crossings - result.crossings);
+    result.crossings += part.crossings;
+    remaining = part.remaining;
+    if (part.border_edge == -1U || result.crossings >= max_crossings) break;
+
+    Link key;
+    key.tile = tp.tile;
+    key.triangle = tp.point.triangle;
+    key.edge = part.border_edge;
+    auto link = std::lower_bound(links.begin(), links.end(), key, link_less);
+    if (link == links.end() || link->tile != key.tile ||
+        link->triangle != key.triangle || link->edge != key.edge) {
+      break;  // (a border with nothing across it; shouldn't happen)
+    }
+    WalkMesh const &next = require(link->next_tile);
+
+    // same as crossing an edge inside a mesh (see WalkMesh::walk): the edge
+    // runs the opposite way in the neighbor, so the weights of its endpoints
+    // swap places, and the step gets rotated over the edge:
+    glm::uvec3 const &tri = mesh->triangles[link->triangle];
+    uint32_t e = link->edge;
+    uint32_t n = link->next_edge;
+    glm::vec3 edge_dir = glm::normalize(mesh->vertices[tri[(e + 2) % 3]] -
+                                        mesh->vertices[tri[(e + 1) % 3]]);
+    glm::vec3 out_dir =
+        glm::cross(edge_dir, mesh->triangle_normals[link->triangle]);
+    glm::vec3 in_dir =
+        glm::cross(edge_dir, next.triangle_normals[link->next_triangle]);
+    remaining = glm::dot(remaining, edge_dir) * edge_dir +
+                glm::dot(remaining, out_dir) * in_dir;
+
+    glm::vec3 next_weights;
+    next_weights[n] = 0.0f;
+    next_weights[(n + 1) % 3] = tp.point.weights[(e + 2) % 3];
+    next_weights[(n + 2) % 3] = tp.point.weights[(e + 1) % 3];
+
+    tp.tile = link->next_tile;
+    tp.point.triangle = link->next_triangle;
+    tp.point.weights = next_weights;
+    mesh = &next;
+    result.crossings += 1;
+  }
+
+  result.consumed = 1.0f - glm::length(remaining) / step_length;
+  result.remaining = remaining;
+  return result;
+}
+
+void WalkTiles::stream(std::vector<TilePoint> const &points) {
+  ++frame;
+
+  // start loading the tiles around each point:
+  for (auto const &tp : points) {
+    if (tp.tile == -1U) continue;
+    int32_t column = int32_t(tp.tile % columns);
+    int32_t row = int32_t(tp.tile / columns);
+    int32_t r = int32_t(radius);
+    for (int32_t y = std::max(0, row - r);
+         y <= std::min(int32_t(rows) - 1, row + r); ++y) {
+      for (int32_t x = std::max(0, column - r);
+           x <= std::min(int32_t(columns) - 1, column + r); ++x) {
+        uint32_t t = uint32_t(y) * columns + uint32_t(x);
+        Tile &tile = tiles[t];
+        if (!tile.exists) continue;
+        tile.last_needed = frame;
+        if (tile.mesh || tile.loading.valid()) continue;
+        std::string path = tile_filename(filename, t);
+        tile.loading = std::async(std::launch::async, [path]() {
+          return std::unique_ptr<WalkMesh>(new WalkMesh(path));
+        });
+        resident.emplace_back(t);
+      }
+    }
+  }
+
+  // pick up finished loads and drop tiles nobody has been near for a while:
+  for (uint32_t i = 0; i < resident.size();) {
+    Tile &tile = tiles[resident[i]];
+    if (tile.loading.valid() &&
+        tile.loading.wait_for(std::chrono::seconds(0)) ==
+            std::future_status::ready) {
+      std::unique_ptr<WalkMesh> mesh = tile.loading.get();
+      check_links(resident[i], *mesh);
+      tile.mesh = std::move(mesh);
+    }
+    if (tile.mesh && frame - tile.last_needed > keep_frames) {
+      tile.mesh.reset();
+      resident[i] = resident.back();
+      resident.pop_back();
+      continue;
+    }
+    ++i;
+  }
+}
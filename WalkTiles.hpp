@@ -0,0 +1,106 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <cassert>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// "WalkTiles" is a walk mesh split into square tiles (on a grid in the xy
+// plane) that are streamed in and out around the walk points in use, so open
+// levels don't have to be held in memory all at once.
+//  Each tile is a separate baked WalkMesh file whose border edges are flagged
+//  (see WalkMesh::triangle_borders); an index file holds the grid and the
+//  links that stitch border edges to the matching edge in the next tile.
+//  Walking across a border carries on in the next tile within the same call.
+// Tiles are made offline (see tile-walk-mesh) with WalkTiles::split().
+
+struct WalkTiles {
+  // reads the index written by split(); no tiles are loaded yet.
+  // note: will throw if the index fails to read.
+  explicit WalkTiles(std::string const &filename);
+
+  // splits 'walk_mesh' into tiles of 'tile_size' by 'tile_size', writing the
+  // index to 'filename' and tile t to tile_filename(filename, t):
+  static void split(WalkMesh const &walk_mesh, float tile_size,
+                    std::string const &filename);
+  static std::string tile_filename(std::string const &filename, uint32_t tile);
+
+  struct TilePoint {
+    uint32_t tile = -1U;
+    WalkMesh::WalkPoint point;  // in the tile's walk mesh
+  };
+
+  // like WalkMesh::start() (finds the same closest point); loads the tiles
+  // that could hold it if needed:
+  TilePoint start(glm::vec3 const &world_point);
+
+  // like WalkMesh::walk(), crossing into neighboring tiles (loading them
+  // right away if streaming hasn't got to them yet):
+  WalkMesh::WalkResult walk(TilePoint &tp, glm::vec3 const &step,
+                            uint32_t max_crossings = 64);
+
+  // (tp's tile must be loaded -- stream() only keeps tiles near the points
+  //  it is given -- so call these with points passed to stream() lately)
+  glm::vec3 world_point(TilePoint const &tp) const {
+    assert(tiles[tp.tile].mesh && "TilePoint's tile isn't loaded.");
+    return tiles[tp.tile].mesh->world_point(tp.point);
+  }
+  glm::vec3 world_normal(TilePoint const &tp) const {
+    assert(tiles[tp.tile].mesh && "TilePoint's tile isn't loaded.");
+    return tiles[tp.tile].mesh->world_normal(tp.point);
+  }
+
+  // call once per frame with the walk points in use: starts loading (in the
+  // background) the tiles within 'radius' tiles of them, picks up tiles that
+  // finished loading, and unloads tiles that haven't been near any walk point
+  // for 'keep_frames' calls:
+  void stream(std::vector<TilePoint> const &points);
+  uint32_t radius = 1;
+  uint32_t keep_frames = 120;
+
+  // tile t's walk mesh, or null if it isn't loaded:
+  WalkMesh const *mesh(uint32_t t) const { return tiles[t].mesh.get(); }
+
+  //------ index ------
+
+  std::string filename;
+  glm::vec2 origin = glm::vec2(0.0f);  // corner of tile 0
+  float tile_size = 1.0f;
+  uint32_t columns = 0, rows = 0;  // tile t is in column t % columns
+
+  // a border edge and the matching edge in the neighboring tile:
+  struct Link {
+    uint32_t tile, triangle, edge;
+    uint32_t next_tile, next_triangle, next_edge;
+  };
+  static_assert(sizeof(Link) == 24, "Link is packed.");
+  std::vector<Link> links;  // sorted by (tile, triangle, edge)
+
+  //------ internals ------
+
+  struct Tile {
+    bool exists = false;  // (grid cells with no triangles have no tile)
+    // bounds of the tile's vertices (triangles go in the tile holding their
+    // centroid, so they can stick out of its grid cell):
+    glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f);
+    std::unique_ptr<WalkMesh> mesh;
+    std::future<std::unique_ptr<WalkMesh>> loading;
+    uint32_t last_needed = 0;
+  };
+  std::vector<Tile> tiles;
+  std::vector<uint32_t> resident;  // tiles that are loaded or loading
+  uint32_t frame = 0;
+
+  // the tile whose cell holds 'point' (or -1U if outside the grid):
+  uint32_t tile_at(glm::vec3 const &point) const;
+
+  // loads tile t now (waiting for a load in progress, if any):
+  WalkMesh const &require(uint32_t t);
+
+  // throws if a link from or into tile t names a triangle past the end of
+  // 'mesh', tile t's walk mesh (checked as each tile loads):
+  void check_links(uint32_t t, WalkMesh const &mesh) const;
+};
@@ -0,0 +1,74 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t threads) {
+  if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+  for (uint32_t t = 1; t < threads; ++t) {
+    workers.emplace_back(&WorkerPool::work, this, t);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) worker.join();
+}
+
+void WorkerPool::run(
+    uint32_t count, uint32_t chunk,
+    std::function<void(uint32_t, uint32_t, uint32_t)> const &fn) {
+  if (workers.empty() || count <= chunk) {
+    for (uint32_t begin = 0; begin < count; begin += chunk) {
+      fn(begin, std::min(count, begin + chunk), 0);
+    }
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &fn;
+    job_count = count;
+    job_chunk = chunk;
+    job_next = 0;
+    job_busy = uint32_t(workers.size());
+    ++job_generation;
+  }
+  wake.notify_all();
+
+  // the calling thread helps out as thread 0:
+  for (uint32_t begin; (begin = job_next.fetch_add(chunk)) < count;) {
+    fn(begin, std::min(count, begin + chunk), 0);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this]() { return job_busy == 0; });
+  job = nullptr;
+}
+
+void WorkerPool::work(uint32_t thread) {
+  uint32_t seen = 0;
+  while (true) {
+    std::function<void(uint32_t, uint32_t, uint32_t)> const *fn;
+    uint32_t count, chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() { return quit || job_generation != seen; });
+      if (quit) return;
+      seen = job_generation;
+      fn = job;
+      count = job_count;
+      chunk = job_chunk;
+    }
+
+    for (uint32_t begin; (begin = job_next.fetch_add(chunk)) < count;) {
+      (*fn)(begin, std::min(count, begin + chunk), thread);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (--job_busy == 0) finished.notify_one();
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// "WorkerPool" keeps a set of threads around for data-parallel loops:
+//  run() splits [0, count) into chunks that the threads (including the
+//  calling thread, as thread 0) take in turn, and returns once every chunk
+//  is done.
+
+struct WorkerPool {
+  // threads == 0 picks one per hardware thread (the calling thread counts as
+  // one of them):
+  explicit WorkerPool(uint32_t threads = 0);
+  ~WorkerPool();
+  WorkerPool(WorkerPool const &) = delete;
+  WorkerPool &operator=(WorkerPool const &) = delete;
+
+  // number of threads, counting the calling thread:
+  uint32_t size() const { return uint32_t(workers.size()) + 1; }
+
+  // calls fn(begin, end, thread) over [0, count) in chunks of (at most)
+  // 'chunk'; with a single chunk, everything runs on the calling thread:
+  void run(uint32_t count, uint32_t chunk,
+           std::function<void(uint32_t, uint32_t, uint32_t)> const &fn);
+
+  //------ internals ------
+
+  void work(uint32_t thread);
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  std::function<void(uint32_t, uint32_t, uint32_t)> const *job = nullptr;
+  uint32_t job_count = 0;
+  uint32_t job_chunk = 0;
+  uint32_t job_generation = 0;
+  uint32_t job_busy = 0;
+  std::atomic<uint32_t> job_next{0};
+  bool quit = false;
+};
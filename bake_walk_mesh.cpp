@@ -0,0 +1,58 @@
+// bake_walk_mesh converts a walk mesh exported by export-walk-mesh.py into the
+// baked format, which also stores adjacency, projection, bvh and grid data so
+// the game can load it without building anything. Optionally, it also builds
+// clusters for hierarchical pathfinding (see WalkClusters.hpp):
+//   bake-walk-mesh <in.blob> <out.blob> [<out.clusters> [cluster size]]
+
+#include "WalkClusters.hpp"
+#include "WalkMesh.hpp"
+
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "Usage:\n\t" << argv[0]
+              << " <in.blob> <out.blob> [<out.clusters> [cluster size]]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    auto before = std::chrono::high_resolution_clock::now();
+    WalkMesh walk_mesh(argv[1]);
+    auto after = std::chrono::high_resolution_clock::now();
+    walk_mesh.save(argv[2]);
+
+    std::cout << "Loaded and built '" << argv[1] << "' in "
+              << std::chrono::duration<double, std::milli>(after - before)
+                     .count()
+              << " ms; wrote '" << argv[2] << "'." << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    WalkMesh baked(argv[2]);
+    after = std::chrono::high_resolution_clock::now();
+    std::cout << "Loading the baked file takes "
+              << std::chrono::duration<double, std::milli>(after - before)
+                     .count()
+              << " ms." << std::endl;
+
+    if (argc >= 4) {
+      uint32_t cluster_size = (argc >= 5 ? uint32_t(std::stoul(argv[4])) : 64);
+      before = std::chrono::high_resolution_clock::now();
+      WalkClusters clusters(baked, cluster_size);
+      after = std::chrono::high_resolution_clock::now();
+      clusters.save(argv[3]);
+      std::cout << "Built " << clusters.cluster_count << " clusters with "
+                << clusters.portal_triangles.size() << " portals and "
+                << clusters.links.size() << " links in "
+                << std::chrono::duration<double, std::milli>(after - before)
+                       .count()
+                << " ms; wrote '" << argv[3] << "'." << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
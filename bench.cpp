@@ -0,0 +1,710 @@
+// bench.cpp is a small command-line program that times the game's hot paths
+// outside of the game itself:
+//   bench walk-many [agents] [frames]
+//   bench find-path [queries] [cache size] [cluster size]
+//   bench visibility [queries]
+//   bench locate [queries]
+//   bench crowd [agents] [ticks]
+//   bench carve [carves] [agents]
+//   bench transforms [transforms] [repeats]
+//   bench transform-threads [transforms] [repeats] [max threads]
+
+#include "Scene.hpp"
+#include "TransformKernels.hpp"
+#include "WalkCrowd.hpp"
+#include "WalkMesh.hpp"
+#include "WalkPathfinder.hpp"
+#include "data_path.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// runs 'fn' and returns how long it took in milliseconds:
+static double time_ms(std::function<void()> const &fn) {
+  auto before = std::chrono::high_resolution_clock::now();
+  fn();
+  auto after = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(after - before).count();
+}
+
+// reads an optional numeric argument:
+static uint32_t arg_or(std::vector<std::string> const &args, uint32_t index,
+                       uint32_t fallback) {
+  if (index < args.size()) return uint32_t(std::stoul(args[index]));
+  return fallback;
+}
+
+//------------------------------------------------------------------
+
+// walk-many: moves a crowd of walk points around the phone bank walk mesh with
+// one walk() call per point and with a single walk_many() call, and reports
+// agents per millisecond for both:
+static void bench_walk_many(std::vector<std::string> const &args) {
+  uint32_t agents = arg_or(args, 0, 10000);
+  uint32_t frames = arg_or(args, 1, 200);
+
+  WalkMesh walk_mesh(data_path("phone-bank-walk.blob"));
+
+  std::mt19937 mt(0x31415926);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  // spawn agents near random vertices of the mesh:
+  std::vector<glm::vec3> spawns(agents);
+  for (auto &spawn : spawns) {
+    spawn = walk_mesh.vertices[mt() % walk_mesh.vertices.size()] +
+            glm::vec3(unit(mt), unit(mt), 0.0f);
+  }
+  std::vector<WalkMesh::WalkPoint> start;
+  walk_mesh.start_many(spawns, &start);
+
+  // per-frame steps, as if agents walked at ~1.5 m/s at 60 fps:
+  std::vector<std::vector<glm::vec3>> steps(frames,
+                                            std::vector<glm::vec3>(agents));
+  for (auto &frame : steps) {
+    for (auto &step : frame) {
+      step = glm::vec3(unit(mt), unit(mt), 0.0f) * (1.5f / 60.0f);
+    }
+  }
+
+  std::vector<WalkMesh::WalkPoint> scalar = start;
+  double scalar_ms = time_ms([&]() {
+    for (auto const &frame : steps) {
+      for (uint32_t i = 0; i < agents; ++i) {
+        walk_mesh.walk(scalar[i], frame[i]);
+      }
+    }
+  });
+
+  std::vector<WalkMesh::WalkPoint> batched = start;
+  double batched_ms = time_ms([&]() {
+    for (auto const &frame : steps) {
+      walk_mesh.walk_many(frame, &batched);
+    }
+  });
+
+  // both paths should end up in the same place:
+  float max_difference = 0.0f;
+  for (uint32_t i = 0; i < agents; ++i) {
+    max_difference = std::max(
+        max_difference, glm::distance(walk_mesh.world_point(scalar[i]),
+                                      walk_mesh.world_point(batched[i])));
+  }
+
+  double agent_steps = double(agents) * double(frames);
+  std::cout << agents << " agents, " << frames << " frames:\n";
+  std::cout << "  walk()      " << scalar_ms << " ms, "
+            << agent_steps / scalar_ms << " agents/ms\n";
+  std::cout << "  walk_many() " << batched_ms << " ms, "
+            << agent_steps / batched_ms << " agents/ms\n";
+  std::cout << "  speedup " << scalar_ms / batched_ms
+            << "x, max position difference " << max_difference << std::endl;
+}
+
+// find-path: routes agents from random spots to one of four goals (like the
+// four phones) and reports queries per millisecond and the cache hit rate;
+// with a cluster size, routes go through WalkClusters built on the spot:
+static void bench_find_path(std::vector<std::string> const &args) {
+  uint32_t queries = arg_or(args, 0, 100000);
+  uint32_t cache_size = arg_or(args, 1, 16);
+  uint32_t cluster_size = arg_or(args, 2, 0);
+
+  WalkMesh walk_mesh(data_path("phone-bank-walk.blob"));
+  std::unique_ptr<WalkClusters> clusters;
+  if (cluster_size) clusters.reset(new WalkClusters(walk_mesh, cluster_size));
+  WalkPathfinder pathfinder(walk_mesh, cache_size, clusters.get());
+
+  std::mt19937 mt(0x27182818);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  auto random_point = [&]() {
+    WalkMesh::WalkPoint wp;
+    wp.triangle = mt() % walk_mesh.triangles.size();
+    float a = unit(mt);
+    float b = unit(mt) * (1.0f - a);
+    wp.weights = glm::vec3(a, b, 1.0f - a - b);
+    return wp;
+  };
+
+  WalkMesh::WalkPoint goals[4];
+  for (auto &goal : goals) goal = random_point();
+
+  // agents start at one of a few dozen spots, since crowds tend to bunch up:
+  std::vector<WalkMesh::WalkPoint> starts(32);
+  for (auto &start : starts) start = random_point();
+
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(queries);
+  for (auto &pair : pairs) {
+    pair = std::make_pair(mt() % starts.size(), mt() % 4);
+  }
+
+  std::vector<glm::vec3> path;
+  uint32_t found = 0;
+  size_t waypoints = 0;
+  double ms = time_ms([&]() {
+    for (auto const &pair : pairs) {
+      if (pathfinder.find_path(starts[pair.first], goals[pair.second], &path)) {
+        ++found;
+        waypoints += path.size();
+      }
+    }
+  });
+
+  std::cout << queries << " queries, cache size " << cache_size;
+  if (clusters) {
+    std::cout << ", " << clusters->cluster_count << " clusters";
+  }
+  std::cout << ":\n";
+  std::cout << "  " << ms << " ms, " << queries / ms << " queries/ms\n";
+  std::cout << "  " << found << " found, "
+            << double(waypoints) / std::max(1U, found)
+            << " waypoints on average\n";
+  std::cout << "  cache " << pathfinder.cache_hits << " hits, "
+            << pathfinder.cache_misses << " misses" << std::endl;
+}
+
+// visibility: line-of-sight checks between nearby walk points and raycasts
+// from random spots toward the mesh, as AI and picking would do them:
+static void bench_visibility(std::vector<std::string> const &args) {
+  uint32_t queries = arg_or(args, 0, 100000);
+
+  WalkMesh walk_mesh(data_path("phone-bank-walk.blob"));
+
+  std::mt19937 mt(0x16180339);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  std::vector<std::pair<WalkMesh::WalkPoint, WalkMesh::WalkPoint>> pairs(
+      queries);
+  for (auto &pair : pairs) {
+    pair.first.triangle = mt() % walk_mesh.triangles.size();
+    pair.first.weights = glm::vec3(1.0f / 3.0f);
+    pair.second = pair.first;
+    walk_mesh.walk(pair.second, glm::vec3(unit(mt), unit(mt), 0.0f) * 4.0f);
+  }
+
+  std::vector<std::pair<glm::vec3, glm::vec3>> rays(queries);
+  for (auto &ray : rays) {
+    ray.first = walk_mesh.vertices[mt() % walk_mesh.vertices.size()] +
+                glm::vec3(unit(mt), unit(mt), unit(mt)) * 4.0f;
+    ray.second = glm::vec3(unit(mt), unit(mt), unit(mt));
+  }
+
+  uint32_t visible = 0;
+  double sight_ms = time_ms([&]() {
+    for (auto const &pair : pairs) {
+      if (walk_mesh.line_of_sight(pair.first, pair.second)) ++visible;
+    }
+  });
+
+  uint32_t hits = 0;
+  double ray_ms = time_ms([&]() {
+    WalkMesh::WalkPoint hit;
+    for (auto const &ray : rays) {
+      if (walk_mesh.raycast(ray.first, ray.second, 100.0f, &hit)) ++hits;
+    }
+  });
+
+  std::cout << queries << " queries:\n";
+  std::cout << "  line_of_sight() " << sight_ms << " ms, "
+            << queries / sight_ms << " queries/ms, " << visible
+            << " visible\n";
+  std::cout << "  raycast()       " << ray_ms << " ms, " << queries / ray_ms
+            << " queries/ms, " << hits << " hits" << std::endl;
+}
+
+// locate: start() with and without the floor grid, and locate(), for points a
+// little above the phone bank's walkable surface:
+static void bench_locate(std::vector<std::string> const &args) {
+  uint32_t queries = arg_or(args, 0, 100000);
+
+  WalkMesh walk_mesh(data_path("phone-bank-walk.blob"));
+  WalkMesh no_grid = walk_mesh;
+  no_grid.grid_offsets.clear();
+  no_grid.grid_triangles.clear();
+
+  std::mt19937 mt(0x10ca7e);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  std::vector<glm::vec3> points(queries);
+  for (auto &point : points) {
+    WalkMesh::WalkPoint wp;
+    wp.triangle = mt() % walk_mesh.triangles.size();
+    wp.weights = glm::vec3(unit(mt), unit(mt), unit(mt));
+    wp.weights /= wp.weights.x + wp.weights.y + wp.weights.z;
+    point = walk_mesh.world_point(wp) + walk_mesh.world_normal(wp) * 0.1f;
+  }
+
+  uint32_t same = 0;
+  std::vector<WalkMesh::WalkPoint> found(queries);
+  double grid_ms = time_ms([&]() {
+    for (uint32_t i = 0; i < queries; ++i) {
+      found[i] = walk_mesh.start(points[i]);
+    }
+  });
+  double bvh_ms = time_ms([&]() {
+    for (uint32_t i = 0; i < queries; ++i) {
+      if (no_grid.start(points[i]).triangle == found[i].triangle) ++same;
+    }
+  });
+  double locate_ms = time_ms([&]() {
+    for (uint32_t i = 0; i < queries; ++i) {
+      found[i] = walk_mesh.locate(points[i]);
+    }
+  });
+
+  std::cout << queries << " queries, " << walk_mesh.grid_columns << "x"
+            << walk_mesh.grid_rows << " grid:\n";
+  std::cout << "  start() with grid " << grid_ms << " ms, "
+            << queries / grid_ms << " queries/ms\n";
+  std::cout << "  start() bvh only  " << bvh_ms << " ms, " << queries / bvh_ms
+            << " queries/ms, " << same << " agree\n";
+  std::cout << "  locate()          " << locate_ms << " ms, "
+            << queries / locate_ms << " queries/ms" << std::endl;
+}
+
+// a flat square walk mesh, 'size' units on a side, made of 'cells' x 'cells'
+// squares (two triangles each):
+static WalkMesh flat_walk_mesh(float size, uint32_t cells) {
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::uvec3> triangles;
+  for (uint32_t y = 0; y <= cells; ++y) {
+    for (uint32_t x = 0; x <= cells; ++x) {
+      vertices.emplace_back(glm::vec3(x, y, 0.0f) * (size / cells));
+      normals.emplace_back(0.0f, 0.0f, 1.0f);
+    }
+  }
+  for (uint32_t y = 0; y < cells; ++y) {
+    for (uint32_t x = 0; x < cells; ++x) {
+      uint32_t a = y * (cells + 1) + x;
+      uint32_t b = a + 1;
+      uint32_t c = a + (cells + 1);
+      uint32_t d = c + 1;
+      triangles.emplace_back(a, b, d);
+      triangles.emplace_back(a, d, c);
+    }
+  }
+  return WalkMesh(vertices, triangles, normals);
+}
+
+// crowd: agents on a large flat floor head for random goals while avoiding
+// each other; reports milliseconds per tick for each thread count, and how
+// many pairs of agents overlap at the end:
+static void bench_crowd(std::vector<std::string> const &args) {
+  uint32_t agents = arg_or(args, 0, 10000);
+  uint32_t ticks = arg_or(args, 1, 100);
+
+  // about 16 square units of floor per agent:
+  float size = 4.0f * std::sqrt(float(agents));
+  WalkMesh walk_mesh = flat_walk_mesh(size, 64);
+
+  std::vector<uint32_t> thread_counts;
+  uint32_t hardware = std::max(1U, std::thread::hardware_concurrency());
+  for (uint32_t threads = 1; threads < hardware; threads *= 2) {
+    thread_counts.emplace_back(threads);
+  }
+  thread_counts.emplace_back(hardware);
+
+  std::cout << agents << " agents, " << ticks << " ticks:\n";
+  for (uint32_t threads : thread_counts) {
+    std::mt19937 mt(0x57a7e);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    WalkCrowd crowd(walk_mesh, threads);
+    std::vector<glm::vec2> goals(agents);
+    for (uint32_t i = 0; i < agents; ++i) {
+      crowd.add(glm::vec3(unit(mt), unit(mt), 0.0f) * size);
+      goals[i] = glm::vec2(unit(mt), unit(mt)) * size;
+    }
+
+    double total_ms = 0.0;
+    for (uint32_t tick = 0; tick < ticks; ++tick) {
+      for (uint32_t i = 0; i < agents; ++i) {
+        glm::vec2 to_goal = goals[i] - glm::vec2(crowd.positions[i]);
+        float distance = glm::length(to_goal);
+        if (distance < 0.5f) {
+          goals[i] = glm::vec2(unit(mt), unit(mt)) * size;
+          crowd.preferred_velocities[i] = glm::vec2(0.0f);
+        } else {
+          crowd.preferred_velocities[i] =
+              to_goal * (crowd.max_speeds[i] / distance);
+        }
+      }
+      total_ms += time_ms([&]() { crowd.update(1.0f / 60.0f); });
+    }
+
+    // (brute force, but only once)
+    uint32_t overlaps = 0;
+    for (uint32_t i = 0; i < agents; ++i) {
+      for (uint32_t j = i + 1; j < agents; ++j) {
+        float radius = crowd.radii[i] + crowd.radii[j];
+        if (glm::distance2(crowd.positions[i], crowd.positions[j]) <
+            0.8f * radius * radius) {
+          ++overlaps;
+        }
+      }
+    }
+
+    std::cout << "  " << threads << " thread(s): " << total_ms / ticks
+              << " ms/tick, " << overlaps << " overlapping pairs\n";
+  }
+  std::cout.flush();
+}
+
+// a random convex footprint: a box 'size' across, rotated, around 'at':
+static std::vector<glm::vec2> box_footprint(glm::vec2 const &at, float size,
+                                            float angle) {
+  glm::vec2 x = glm::vec2(std::cos(angle), std::sin(angle)) * (0.5f * size);
+  glm::vec2 y = glm::vec2(-x.y, x.x);
+  return {at - x - y, at + x - y, at + x + y, at - x + y};
+}
+
+// carve: drops crates on a flat floor (with a crowd of walk points on it) and
+// on the phone bank floor, carving each one into the walk mesh; reports the
+// time per carve next to the time to rebuild the whole mesh:
+static void bench_carve(std::vector<std::string> const &args) {
+  uint32_t carves = arg_or(args, 0, 200);
+  uint32_t agents = arg_or(args, 1, 1000);
+
+  std::mt19937 mt(0xca4e);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  // crates land anywhere in [min, max] (x and y), on a floor at height z:
+  auto run = [&](char const *name, WalkMesh walk_mesh, glm::vec2 const &min,
+                 glm::vec2 const &max, float z) {
+    std::vector<WalkMesh::WalkPoint> walk_points(agents);
+    for (auto &wp : walk_points) {
+      wp = walk_mesh.start(glm::vec3(min + (max - min) * glm::vec2(unit(mt),
+                                                                   unit(mt)),
+                                     z));
+    }
+    uint32_t before = uint32_t(walk_mesh.triangles.size());
+
+    WalkMesh::CarveResult total;
+    double carve_ms = 0.0;
+    for (uint32_t i = 0; i < carves; ++i) {
+      glm::vec2 at = min + (max - min) * glm::vec2(unit(mt), unit(mt));
+      auto footprint =
+          box_footprint(at, 0.3f + 0.7f * unit(mt), 6.2831853f * unit(mt));
+      WalkMesh::CarveResult result;
+      carve_ms += time_ms([&]() {
+        result = walk_mesh.carve(footprint, z - 0.5f, z + 0.5f, &walk_points);
+      });
+      total.cut += result.cut;
+      total.split += result.split;
+      total.removed += result.removed;
+      total.added += result.added;
+      total.added_vertices += result.added_vertices;
+      total.moved += result.moved;
+    }
+
+    // the alternative: rebuild everything (adjacency, BVH, grid) from the
+    // carved triangles:
+    double rebuild_ms = time_ms([&]() {
+      WalkMesh rebuilt(walk_mesh.vertices, walk_mesh.triangles,
+                       walk_mesh.vertex_normals);
+    });
+
+    std::cout << name << ", " << before << " -> " << walk_mesh.triangles.size()
+              << " triangles:\n";
+    std::cout << "  carve()   " << carve_ms / carves << " ms/carve, "
+              << total.cut << " cut, " << total.split << " split, "
+              << total.removed << " removed, " << total.added << " added, "
+              << total.added_vertices << " vertices, " << total.moved
+              << " walk points moved\n";
+    std::cout << "  rebuild   " << rebuild_ms << " ms" << std::endl;
+  };
+
+  std::cout << carves << " carves, " << agents << " walk points:\n";
+  run("flat floor", flat_walk_mesh(32.0f, 64), glm::vec2(1.0f),
+      glm::vec2(31.0f), 0.0f);
+
+  WalkMesh phone_bank(data_path("phone-bank-walk.blob"));
+  glm::vec3 lo = glm::vec3(std::numeric_limits<float>::infinity());
+  glm::vec3 hi = -lo;
+  for (auto const &v : phone_bank.vertices) {
+    lo = glm::min(lo, v);
+    hi = glm::max(hi, v);
+  }
+  run("phone bank", std::move(phone_bank), glm::vec2(lo), glm::vec2(hi), lo.z);
+}
+
+// transforms: builds a random hierarchy, grouped into depth levels as
+// Scene::update_transforms() does, and computes every world matrix with plain
+// glm products (as Scene did before TransformKernels), with the scalar kernel
+// and with the batched kernel; reports nanoseconds per transform for each:
+static void bench_transforms(std::vector<std::string> const &args) {
+  uint32_t count = arg_or(args, 0, 100000);
+  uint32_t repeats = arg_or(args, 1, 20);
+
+  std::mt19937 mt(0x7f5);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  // transform i's parent is some earlier transform (or none, for roots):
+  std::vector<uint32_t> parents(count, -1U);
+  std::vector<uint32_t> depths(count, 0);
+  uint32_t max_depth = 0;
+  for (uint32_t i = 1; i < count; ++i) {
+    if (mt() % 16 == 0) continue;
+    // (mostly recent transforms, so chains get a few dozen levels deep)
+    uint32_t back = 1 + mt() % std::min(i, 64U);
+    parents[i] = i - back;
+    depths[i] = depths[parents[i]] + 1;
+    max_depth = std::max(max_depth, depths[i]);
+  }
+
+  std::vector<glm::vec3> positions(count), scales(count);
+  std::vector<glm::quat> rotations(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    positions[i] = glm::vec3(unit(mt), unit(mt), unit(mt)) * 2.0f;
+    rotations[i] = glm::normalize(glm::quat(unit(mt), unit(mt), unit(mt),
+                                            unit(mt)));
+    scales[i] = glm::vec3(1.0f) + 0.2f * glm::vec3(unit(mt), unit(mt),
+                                                   unit(mt));
+  }
+
+  // world matrices from each method:
+  struct Worlds {
+    std::vector<glm::mat4> local_to_world, world_to_local;
+  };
+  Worlds reference, scalar, batched;
+  for (Worlds *w : {&reference, &scalar, &batched}) {
+    w->local_to_world.resize(count);
+    w->world_to_local.resize(count);
+  }
+
+  // one job list per depth level, parents first:
+  auto make_levels = [&](Worlds &w) {
+    std::vector<std::vector<WorldMatrixJob>> levels(max_depth + 1);
+    for (uint32_t i = 0; i < count; ++i) {
+      WorldMatrixJob job;
+      job.position = &positions[i];
+      job.rotation = &rotations[i];
+      job.scale = &scales[i];
+      bool root = (parents[i] == -1U);
+      job.parent_local_to_world =
+          (root ? nullptr : &w.local_to_world[parents[i]]);
+      job.parent_world_to_local =
+          (root ? nullptr : &w.world_to_local[parents[i]]);
+      job.local_to_world = &w.local_to_world[i];
+      job.world_to_local = &w.world_to_local[i];
+      levels[depths[i]].emplace_back(job);
+    }
+    return levels;
+  };
+  auto scalar_levels = make_levels(scalar);
+  auto batched_levels = make_levels(batched);
+
+  double reference_ms = time_ms([&]() {
+    for (uint32_t r = 0; r < repeats; ++r) {
+      // (parents always have lower indices, so index order is parents-first)
+      for (uint32_t i = 0; i < count; ++i) {
+        glm::vec3 const &s = scales[i];
+        glm::vec3 inv_s = glm::vec3(s.x == 0.0f ? 0.0f : 1.0f / s.x,
+                                    s.y == 0.0f ? 0.0f : 1.0f / s.y,
+                                    s.z == 0.0f ? 0.0f : 1.0f / s.z);
+        glm::mat4 local =
+            glm::mat4(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+                      glm::vec4(positions[i], 1.0f)) *
+            glm::mat4_cast(rotations[i]) *
+            glm::mat4(glm::vec4(s.x, 0.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, s.y, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 0.0f, s.z, 0.0f),
+                      glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        glm::mat4 inverse =
+            glm::mat4(glm::vec4(inv_s.x, 0.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, inv_s.y, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 0.0f, inv_s.z, 0.0f),
+                      glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)) *
+            glm::mat4_cast(glm::inverse(rotations[i])) *
+            glm::mat4(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+                      glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+                      glm::vec4(-positions[i], 1.0f));
+        if (parents[i] == -1U) {
+          reference.local_to_world[i] = local;
+          reference.world_to_local[i] = inverse;
+        } else {
+          reference.local_to_world[i] =
+              reference.local_to_world[parents[i]] * local;
+          reference.world_to_local[i] =
+              inverse * reference.world_to_local[parents[i]];
+        }
+      }
+    }
+  });
+
+  auto run = [&](std::vector<std::vector<WorldMatrixJob>> const &levels,
+                 void (*update)(WorldMatrixJob const *, uint32_t)) {
+    return time_ms([&]() {
+      for (uint32_t r = 0; r < repeats; ++r) {
+        for (auto const &level : levels) {
+          update(level.data(), uint32_t(level.size()));
+        }
+      }
+    });
+  };
+  double scalar_ms = run(scalar_levels, update_world_matrices_scalar);
+  double batched_ms = run(batched_levels, update_world_matrices);
+
+  // (the kernels should agree exactly; glm only up to rounding)
+  float max_difference = 0.0f;
+  for (uint32_t i = 0; i < count; ++i) {
+    for (uint32_t c = 0; c < 4; ++c) {
+      max_difference = std::max(
+          max_difference,
+          glm::length(reference.local_to_world[i][c] -
+                      batched.local_to_world[i][c]));
+    }
+  }
+  bool identical =
+      std::memcmp(scalar.local_to_world.data(), batched.local_to_world.data(),
+                  count * sizeof(glm::mat4)) == 0 &&
+      std::memcmp(scalar.world_to_local.data(), batched.world_to_local.data(),
+                  count * sizeof(glm::mat4)) == 0;
+
+  double per = 1e6 / (double(count) * repeats);
+  std::cout << count << " transforms, " << max_depth + 1 << " levels, "
+            << repeats << " repeats:\n";
+  std::cout << "  glm products  " << reference_ms * per << " ns/transform\n";
+  std::cout << "  scalar kernel " << scalar_ms * per << " ns/transform\n";
+  std::cout << "  batch kernel  " << batched_ms * per << " ns/transform ("
+            << scalar_ms / batched_ms << "x scalar)\n";
+  std::cout << "  max difference from glm " << max_difference
+            << "; scalar and batch kernels "
+            << (identical ? "identical" : "DIFFER") << std::endl;
+}
+
+// transform-threads: updates every world matrix of a deep hierarchy (many
+// long chains) and of a wide one (a few levels of many children) with
+// Scene::update_transforms() on a WorkerPool of each thread count; reports
+// milliseconds per update and checks the results match the serial update:
+static void bench_transform_threads(std::vector<std::string> const &args) {
+  uint32_t count = arg_or(args, 0, 100000);
+  uint32_t repeats = arg_or(args, 1, 20);
+  uint32_t hardware = std::max(1U, std::thread::hardware_concurrency());
+  uint32_t max_threads = arg_or(args, 2, hardware);
+
+  std::vector<uint32_t> thread_counts;
+  for (uint32_t threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.emplace_back(threads);
+  }
+  thread_counts.emplace_back(max_threads);
+
+  // builds 'count' transforms where transform i hangs off parent_of(i):
+  auto run = [&](char const *name,
+                 std::function<uint32_t(uint32_t)> const &parent_of) {
+    std::mt19937 mt(0x7f5);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    Scene scene;
+    std::vector<Scene::Transform *> transforms(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      transforms[i] = scene.new_transform();
+      transforms[i]->position = glm::vec3(unit(mt), unit(mt), unit(mt));
+      transforms[i]->rotation = glm::normalize(
+          glm::quat(unit(mt), unit(mt), unit(mt), unit(mt)));
+      uint32_t parent = parent_of(i);
+      if (parent != -1U) transforms[i]->set_parent(transforms[parent]);
+    }
+    std::vector<Scene::Transform *> roots;
+    std::vector<glm::vec3> root_positions;
+    for (auto transform : transforms) {
+      if (transform->parent) continue;
+      roots.emplace_back(transform);
+      root_positions.emplace_back(transform->position);
+    }
+
+    scene.update_transforms();
+    std::vector<glm::mat4> serial(2 * count);
+    for (uint32_t i = 0; i < count; ++i) {
+      serial[2 * i] = transforms[i]->local_to_world;
+      serial[2 * i + 1] = transforms[i]->world_to_local;
+    }
+
+    scene.sort_transforms();
+    std::cout << name << ", " << count << " transforms, "
+              << scene.transform_levels.size() - 1 << " levels, "
+              << roots.size() << " roots:\n";
+    for (uint32_t threads : thread_counts) {
+      WorkerPool pool(threads);
+      scene.transform_workers = &pool;
+      double total_ms = 0.0;
+      for (uint32_t r = 0; r < repeats; ++r) {
+        // (moving every root dirties everything)
+        for (uint32_t i = 0; i < roots.size(); ++i) {
+          roots[i]->set_position(root_positions[i] + glm::vec3(0.01f * r));
+        }
+        total_ms += time_ms([&]() { scene.update_transforms(); });
+      }
+      // put the roots back for the comparison with the serial update:
+      for (uint32_t i = 0; i < roots.size(); ++i) {
+        roots[i]->set_position(root_positions[i]);
+      }
+      scene.update_transforms();
+      scene.transform_workers = nullptr;
+
+      uint32_t mismatched = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        if (std::memcmp(&serial[2 * i], &transforms[i]->local_to_world,
+                        sizeof(glm::mat4)) != 0 ||
+            std::memcmp(&serial[2 * i + 1], &transforms[i]->world_to_local,
+                        sizeof(glm::mat4)) != 0) {
+          ++mismatched;
+        }
+      }
+      std::cout << "  " << threads << " thread(s): " << total_ms / repeats
+                << " ms/update, " << mismatched
+                << " transforms differ from serial\n";
+    }
+  };
+
+  // 500 chains hanging off their own roots:
+  uint32_t chains = std::min(count, 500U);
+  run("deep", [&](uint32_t i) { return (i < chains ? -1U : i - chains); });
+  // 10 roots with 100 children each, then everything else spread under
+  // those children:
+  run("wide", [&](uint32_t i) {
+    if (i < 10) return -1U;
+    if (i < 1010) return (i - 10) / 100;
+    return 10 + (i % 1000);
+  });
+  std::cout.flush();
+}
+
+//------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::function<void(std::vector<std::string> const &)>>
+      benchmarks;
+  benchmarks["walk-many"] = bench_walk_many;
+  benchmarks["find-path"] = bench_find_path;
+  benchmarks["visibility"] = bench_visibility;
+  benchmarks["locate"] = bench_locate;
+  benchmarks["crowd"] = bench_crowd;
+  benchmarks["carve"] = bench_carve;
+  benchmarks["transforms"] = bench_transforms;
+  benchmarks["transform-threads"] = bench_transform_threads;
+
+  if (argc < 2 || !benchmarks.count(argv[1])) {
+    std::cerr << "Usage:\n\t" << argv[0] << " <benchmark> [args...]\n"
+              << "Benchmarks:\n";
+    for (auto const &entry : benchmarks) {
+      std::cerr << "\t" << entry.first << "\n";
+    }
+    return 1;
+  }
+
+  std::vector<std::string> args(argv + 2, argv + argc);
+  benchmarks[argv[1]](args);
+  return 0;
+}
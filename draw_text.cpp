@@ -5,6 +5,7 @@
 #include "MeshBuffer.hpp"
 #include "data_path.hpp"
 #include "compile_program.hpp"
+#include "gl_state.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -76,8 +77,8 @@ void draw_text(std::string const &text, glm::vec2 const &anchor, float height, g
 }
 
 void draw_text(std::string const &text, glm::mat4 const &transform, glm::vec4 color) {
-  glUseProgram(*text_program);
-  glBindVertexArray(*text_meshes_for_text_program);
+  gl_use_program(*text_program);
+  gl_bind_vertex_array(*text_meshes_for_text_program);
 
   float x = 0.0f;
   for (uint32_t i = 0; i < text.size(); ++i) {
@@ -100,8 +101,8 @@ void draw_text(std::string const &text, glm::mat4 const &transform, glm::vec4 co
     x += char_width(text[i]);
   }
 
-  glBindVertexArray(0);
-  glUseProgram(0);
+  gl_bind_vertex_array(0);
+  gl_use_program(0);
 }
 
 float text_width(std::string const &text, float height) {
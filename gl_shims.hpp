@@ -154,6 +154,7 @@ DO(ISBUFFER, IsBuffer)
 DO(BUFFERDATA, BufferData)
 DO(BUFFERSUBDATA, BufferSubData)
 DO(GETBUFFERSUBDATA, GetBufferSubData)
+DO(MAPBUFFER, MapBuffer)
 DO(UNMAPBUFFER, UnmapBuffer)
 DO(GETBUFFERPARAMETERIV, GetBufferParameteriv)
 DO(GETBUFFERPOINTERV, GetBufferPointerv)
@@ -319,6 +320,7 @@ DO(CLEARBUFFERIV, ClearBufferiv)
 DO(CLEARBUFFERUIV, ClearBufferuiv)
 DO(CLEARBUFFERFV, ClearBufferfv)
 DO(CLEARBUFFERFI, ClearBufferfi)
+DO(GETSTRINGI, GetStringi)
 DO(ISRENDERBUFFER, IsRenderbuffer)
 DO(BINDRENDERBUFFER, BindRenderbuffer)
 DO(DELETERENDERBUFFERS, DeleteRenderbuffers)
@@ -339,6 +341,7 @@ DO(GENERATEMIPMAP, GenerateMipmap)
 DO(BLITFRAMEBUFFER, BlitFramebuffer)
 DO(RENDERBUFFERSTORAGEMULTISAMPLE, RenderbufferStorageMultisample)
 DO(FRAMEBUFFERTEXTURELAYER, FramebufferTextureLayer)
+DO(MAPBUFFERRANGE, MapBufferRange)
 DO(FLUSHMAPPEDBUFFERRANGE, FlushMappedBufferRange)
 DO(BINDVERTEXARRAY, BindVertexArray)
 DO(DELETEVERTEXARRAYS, DeleteVertexArrays)
@@ -380,4 +383,34 @@ DO(TEXIMAGE3DMULTISAMPLE, TexImage3DMultisample)
 DO(GETMULTISAMPLEFV, GetMultisamplefv)
 DO(SAMPLEMASKI, SampleMaski)
 
+// GL_VERSION_3_3 extensions:
+DO(BINDFRAGDATALOCATIONINDEXED, BindFragDataLocationIndexed)
+DO(GETFRAGDATAINDEX, GetFragDataIndex)
+DO(GENSAMPLERS, GenSamplers)
+DO(DELETESAMPLERS, DeleteSamplers)
+DO(ISSAMPLER, IsSampler)
+DO(BINDSAMPLER, BindSampler)
+DO(SAMPLERPARAMETERI, SamplerParameteri)
+DO(SAMPLERPARAMETERIV, SamplerParameteriv)
+DO(SAMPLERPARAMETERF, SamplerParameterf)
+DO(SAMPLERPARAMETERFV, SamplerParameterfv)
+DO(SAMPLERPARAMETERIIV, SamplerParameterIiv)
+DO(SAMPLERPARAMETERIUIV, SamplerParameterIuiv)
+DO(GETSAMPLERPARAMETERIV, GetSamplerParameteriv)
+DO(GETSAMPLERPARAMETERIIV, GetSamplerParameterIiv)
+DO(GETSAMPLERPARAMETERFV, GetSamplerParameterfv)
+DO(GETSAMPLERPARAMETERIUIV, GetSamplerParameterIuiv)
+DO(QUERYCOUNTER, QueryCounter)
+DO(GETQUERYOBJECTI64V, GetQueryObjecti64v)
+DO(GETQUERYOBJECTUI64V, GetQueryObjectui64v)
+DO(VERTEXATTRIBDIVISOR, VertexAttribDivisor)
+DO(VERTEXATTRIBP1UI, VertexAttribP1ui)
+DO(VERTEXATTRIBP1UIV, VertexAttribP1uiv)
+DO(VERTEXATTRIBP2UI, VertexAttribP2ui)
+DO(VERTEXATTRIBP2UIV, VertexAttribP2uiv)
+DO(VERTEXATTRIBP3UI, VertexAttribP3ui)
+DO(VERTEXATTRIBP3UIV, VertexAttribP3uiv)
+DO(VERTEXATTRIBP4UI, VertexAttribP4ui)
+DO(VERTEXATTRIBP4UIV, VertexAttribP4uiv)
+
 #endif //GL_SHIMS_HPP
@@ -0,0 +1,95 @@
+#include "gl_state.hpp"
+
+#include <vector>
+#include <utility>
+
+GLStateCounts gl_state_counts;
+GLStateCounts gl_state_last_frame_counts;
+
+namespace {
+  //cached values are only trusted when the matching 'known' flag is set:
+  struct {
+    bool program_known = false;
+    GLuint program = 0;
+    bool vao_known = false;
+    GLuint vao = 0;
+    bool blend_func_known = false;
+    GLenum blend_sfactor = 0, blend_dfactor = 0;
+    bool blend_equation_known = false;
+    GLenum blend_equation = 0;
+    std::vector< std::pair< GLenum, bool > > caps; //(capability, enabled) for every capability touched so far
+  } cache;
+
+  //returns true (and counts an issued call) if the call is needed:
+  bool issue(bool needed) {
+    if (needed) gl_state_counts.issued += 1;
+    else gl_state_counts.skipped += 1;
+    return needed;
+  }
+
+  void set_cap(GLenum cap, bool enabled) {
+    for (auto &entry : cache.caps) {
+      if (entry.first == cap) {
+        if (!issue(entry.second != enabled)) return;
+        entry.second = enabled;
+        if (enabled) glEnable(cap);
+        else glDisable(cap);
+        return;
+      }
+    }
+    issue(true);
+    cache.caps.emplace_back(cap, enabled);
+    if (enabled) glEnable(cap);
+    else glDisable(cap);
+  }
+}
+
+void gl_use_program(GLuint program) {
+  if (!issue(!cache.program_known || cache.program != program)) return;
+  cache.program_known = true;
+  cache.program = program;
+  glUseProgram(program);
+}
+
+void gl_bind_vertex_array(GLuint vao) {
+  if (!issue(!cache.vao_known || cache.vao != vao)) return;
+  cache.vao_known = true;
+  cache.vao = vao;
+  glBindVertexArray(vao);
+}
+
+void gl_enable(GLenum cap) {
+  set_cap(cap, true);
+}
+
+void gl_disable(GLenum cap) {
+  set_cap(cap, false);
+}
+
+void gl_blend_func(GLenum sfactor, GLenum dfactor) {
+  if (!issue(!cache.blend_func_known || cache.blend_sfactor != sfactor || cache.blend_dfactor != dfactor)) return;
+  cache.blend_func_known = true;
+  cache.blend_sfactor = sfactor;
+  cache.blend_dfactor = dfactor;
+  glBlendFunc(sfactor, dfactor);
+}
+
+void gl_blend_equation(GLenum mode) {
+  if (!issue(!cache.blend_equation_known || cache.blend_equation != mode)) return;
+  cache.blend_equation_known = true;
+  cache.blend_equation = mode;
+  glBlendEquation(mode);
+}
+
+void gl_state_forget() {
+  cache.program_known = false;
+  cache.vao_known = false;
+  cache.blend_func_known = false;
+  cache.blend_equation_known = false;
+  cache.caps.clear();
+}
+
+void gl_state_new_frame() {
+  gl_state_last_frame_counts = gl_state_counts;
+  gl_state_counts = GLStateCounts();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "GL.hpp"
+
+#include <cstdint>
+
+//Helper functions that cache a little OpenGL state, so calls that wouldn't change anything are skipped:
+// all code that changes this state should go through these functions;
+// after changing it any other way, call gl_state_forget() so the cache doesn't go stale.
+
+void gl_use_program(GLuint program);
+void gl_bind_vertex_array(GLuint vao);
+void gl_enable(GLenum cap);
+void gl_disable(GLenum cap);
+void gl_blend_func(GLenum sfactor, GLenum dfactor);
+void gl_blend_equation(GLenum mode);
+
+//forget everything cached (the next call of each kind is always issued):
+void gl_state_forget();
+
+//how many calls were passed to OpenGL and how many were skipped:
+struct GLStateCounts {
+  uint32_t issued = 0;
+  uint32_t skipped = 0;
+};
+//counts for the frame so far, and for the last whole frame:
+extern GLStateCounts gl_state_counts;
+extern GLStateCounts gl_state_last_frame_counts;
+//call once per frame (main does this before drawing):
+void gl_state_new_frame();
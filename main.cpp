@@ -14,6 +14,12 @@
 // GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
 
+// gl_state.hpp skips redundant OpenGL state changes (and counts them per frame):
+#include "gl_state.hpp"
+
+// UniformRing.hpp streams per-object uniforms (it can use buffer storage):
+#include "UniformRing.hpp"
+
 // Includes for libSDL:
 #include <SDL.h>
 
@@ -25,6 +31,7 @@
 //...and for c++ standard library functions:
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -84,6 +91,22 @@ int main(int argc, char **argv) {
   init_gl_shims();
 #endif
 
+  // Persistently-mapped buffers make streaming uniforms cheaper, but need
+  // ARB_buffer_storage (core in 4.4, above the 3.3 context asked for):
+  {
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions; ++i) {
+      char const *name = reinterpret_cast<char const *>(
+          glGetStringi(GL_EXTENSIONS, GLuint(i)));
+      if (name && std::strcmp(name, "GL_ARB_buffer_storage") == 0) {
+        uniform_ring_buffer_storage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(
+            SDL_GL_GetProcAddress("glBufferStorage"));
+        break;
+      }
+    }
+  }
+
   // Set VSYNC + Late Swap (prevents crazy FPS):
   if (SDL_GL_SetSwapInterval(-1) != 0) {
     std::cerr << "NOTE: couldn't set vsync + late swap tearing ("
@@ -167,12 +190,13 @@ int main(int argc, char **argv) {
     }
 
     {  //(3) call the current mode's "draw" function to produce output:
+      gl_state_new_frame();
       // clear the depth+color buffers and set some default state:
       glClearColor(0.5, 0.5, 0.5, 0.0);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      glEnable(GL_DEPTH_TEST);
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      gl_enable(GL_DEPTH_TEST);
+      gl_enable(GL_BLEND);
+      gl_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
       Mode::current->draw(drawable_size);
     }
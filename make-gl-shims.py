@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 # create gl_shims.hpp by parsing everything from glcorearb.h (why not the regsistry xml, hmmmm?) and selecting only things that are core through version 3_3.
+# usage (from the directory holding glcorearb.h): python3 make-gl-shims.py > gl_shims.hpp
 
 import re
 
@@ -9,6 +10,7 @@ extensions = []
 
 with open('glcorearb.h', 'r') as f:
     in_version = None
+    decl = None # a GLAPI declaration (which may span several lines) read so far
     for line in f:
         m = re.match(r"^#ifndef (GL_VERSION_(\d)_(\d))", line)
         if m != None:
@@ -20,7 +22,7 @@ with open('glcorearb.h', 'r') as f:
                 protos.append("\n// " + in_version + " prototypes:\n")
                 do_proto = True
                 do_extension = False
-            elif (major, minor) < (3, 3):
+            elif (major, minor) <= (3, 3):
                 extensions.append("\n// " + in_version + " extensions:\n")
                 do_proto = False
                 do_extension = True
@@ -28,19 +30,24 @@ with open('glcorearb.h', 'r') as f:
                 do_proto = False
                 do_extension = False
         if in_version:
-            if do_proto:
-                m = re.match(r"^GLAPI ", line)
-                if m != None:
-                    protos.append(line)
-                pass
-            if do_extension:
-                #	m = re.match(r".* PFNGL([^)]+)PROC\)", line)
-                m = re.match(r"GLAPI .* APIENTRY gl([^ ]+) \(", line)
-                if m != None:
-                    lc = m.group(1)
-                    uc = lc.upper()
-                    extensions.append("DO(" + uc + ", " + lc + ")\n")
-                pass
+            if decl == None and re.match(r"^GLAPI ", line):
+                decl = ""
+            if decl != None:
+                if decl != "":
+                    # line up continued parameters under the first one:
+                    line = " " * (decl.index("(") + 1) + line.lstrip()
+                decl += line
+                if ';' in line:
+                    if do_proto:
+                        protos.append(decl)
+                    if do_extension:
+                        # (functions returning pointers have no space before APIENTRY, e.g. 'void *APIENTRY glMapBufferRange')
+                        m = re.match(r"GLAPI .*APIENTRY\s*gl(\w+)\s*\(", decl)
+                        assert m != None, decl
+                        lc = m.group(1)
+                        uc = lc.upper()
+                        extensions.append("DO(" + uc + ", " + lc + ")\n")
+                    decl = None
             m = re.match(r"^#endif /\* " + in_version + " \*/$", line)
             if m != None:
                 in_version = None
@@ -58,7 +65,7 @@ void init_gl_shims(); //will throw on failure.
 extern "C" {
 """)
 
-print("".join(protos))
+print("".join(protos), end="")
 
 print("""
 }
@@ -68,8 +75,7 @@ print("""
 //--------------------------------------------------------
 
 #ifndef DO
-#define DO(TYPE, NAME) \
-	extern PFNGL ## TYPE ## PROC gl ## NAME;
+#define DO(TYPE, NAME)    extern PFNGL ## TYPE ## PROC gl ## NAME;
 #endif
 
 """)
@@ -33,3 +33,17 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector<T> *_t
     throw std::runtime_error("Failed to read chunk data.");
   }
 }
+
+//writes a chunk in the format read_chunk expects:
+template<typename T>
+void write_chunk(std::ostream &to, std::string const &magic, std::vector<T> const &from) {
+  assert(magic.size() == 4);
+
+  uint32_t size = uint32_t(from.size() * sizeof(T));
+  to.write(magic.c_str(), 4);
+  to.write(reinterpret_cast< char const * >(&size), sizeof(size));
+  if (size) to.write(reinterpret_cast< char const * >(&from[0]), size);
+  if (!to) {
+    throw std::runtime_error("Failed to write chunk.");
+  }
+}
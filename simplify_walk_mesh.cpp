@@ -0,0 +1,504 @@
+// simplify_walk_mesh decimates a walk mesh exported by export-walk-mesh.py,
+// since walking, start() and pathfinding all get slower with triangle count
+// and artists model far more detail than walking needs:
+//   simplify-walk-mesh <in.blob> <out.blob> [tolerance]
+// Vertices are removed one at a time by collapsing them into a neighbor
+// (surviving vertices never move, so their normals stay right), cheapest
+// first. A collapse is only made if every removed vertex stays within
+// 'tolerance' (0.05 units by default) of the simplified surface and the
+// boundary of the walkable area moves by no more than that: boundary
+// vertices are only collapsed along the boundary, where it is straight
+// enough. Collapses that would flip or crush triangles, or change the
+// topology, are skipped.
+// The result is written in the same (unbaked) format as the input; run
+// bake-walk-mesh on it afterwards if wanted. Statistics on the reduction and
+// on how much faster queries got are printed at the end.
+
+#include "WalkMesh.hpp"
+#include "WalkPathfinder.hpp"
+#include "read_chunk.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <queue>
+#include <random>
+#include <vector>
+
+// new triangles must be at least this well-shaped (1 is equilateral), unless
+// the ones they replace were already worse:
+static const float QualityFloor = 0.2f;
+
+// 1 for an equilateral triangle, 0 for a degenerate one:
+static float quality(glm::vec3 const &a, glm::vec3 const &b,
+                     glm::vec3 const &c) {
+  float edges = glm::length2(b - a) + glm::length2(c - b) + glm::length2(a - c);
+  if (edges == 0.0f) return 0.0f;
+  return 2.0f * std::sqrt(3.0f) * glm::length(glm::cross(b - a, c - a)) /
+         edges;
+}
+
+static float distance_to_segment(glm::vec3 const &p, glm::vec3 const &a,
+                                 glm::vec3 const &b) {
+  glm::vec3 ab = b - a;
+  float length2 = glm::length2(ab);
+  float t = (length2 > 0.0f ? glm::dot(p - a, ab) / length2 : 0.0f);
+  return glm::distance(p, a + glm::clamp(t, 0.0f, 1.0f) * ab);
+}
+
+static float distance_to_triangle(glm::vec3 const &p, glm::vec3 const &a,
+                                  glm::vec3 const &b, glm::vec3 const &c) {
+  glm::vec3 n = glm::cross(b - a, c - a);
+  float n2 = glm::length2(n);
+  if (n2 > 0.0f) {
+    // inside the triangle's prism, the distance is to the plane:
+    glm::vec3 q = p - (glm::dot(p - a, n) / n2) * n;
+    if (glm::dot(glm::cross(b - a, q - a), n) >= 0.0f &&
+        glm::dot(glm::cross(c - b, q - b), n) >= 0.0f &&
+        glm::dot(glm::cross(a - c, q - c), n) >= 0.0f) {
+      return glm::distance(p, q);
+    }
+  }
+  return std::min(distance_to_segment(p, a, b),
+                  std::min(distance_to_segment(p, b, c),
+                           distance_to_segment(p, c, a)));
+}
+
+// the mesh as it is being simplified; removed vertices are remembered by the
+// triangle (or boundary edge) nearest them, so every collapse can check that
+// they all stay within tolerance:
+struct Simplifier {
+  Simplifier(std::vector<glm::vec3> const &vertices_,
+             std::vector<glm::uvec3> const &triangles_, float tolerance_)
+      : vertices(vertices_), triangles(triangles_), tolerance(tolerance_) {
+    alive.assign(triangles.size(), 1);
+    absorbed.resize(triangles.size());
+    vertex_triangles.resize(vertices.size());
+    for (uint32_t t = 0; t < triangles.size(); ++t) {
+      for (uint32_t i = 0; i < 3; ++i) {
+        vertex_triangles[triangles[t][i]].emplace_back(t);
+      }
+    }
+    removed.assign(vertices.size(), 0);
+    stamps.assign(vertices.size(), 0);
+  }
+
+  std::vector<glm::vec3> const &vertices;
+  std::vector<glm::uvec3> triangles;
+  float tolerance;
+
+  std::vector<uint8_t> alive;
+  std::vector<std::vector<uint32_t>> absorbed;  // removed interior vertices
+  // removed boundary vertices, by the boundary edge (as directed in its
+  // triangle) they lie along:
+  std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t>>
+      edge_absorbed;
+  std::vector<std::vector<uint32_t>> vertex_triangles;  // (alive only)
+  std::vector<uint8_t> removed;
+
+  // vertex u's fan: a disk (interior), a half-disk (boundary, running from
+  // 'prev' to 'next' around u), or something else (locked):
+  enum Kind { Interior, Boundary, Locked };
+  Kind classify(uint32_t u, uint32_t *prev, uint32_t *next) const {
+    std::map<uint32_t, int> out_edges, in_edges;  // u -> n and n -> u
+    for (uint32_t t : vertex_triangles[u]) {
+      glm::uvec3 const &tri = triangles[t];
+      uint32_t i = (tri.x == u ? 0 : tri.y == u ? 1 : 2);
+      ++out_edges[tri[(i + 1) % 3]];
+      ++in_edges[tri[(i + 2) % 3]];
+    }
+    uint32_t prevs = 0, nexts = 0;
+    for (auto const &e : out_edges) {
+      if (e.second > 1) return Locked;
+      if (!in_edges.count(e.first)) {
+        *next = e.first;
+        ++nexts;
+      }
+    }
+    for (auto const &e : in_edges) {
+      if (e.second > 1) return Locked;
+      if (!out_edges.count(e.first)) {
+        *prev = e.first;
+        ++prevs;
+      }
+    }
+    if (prevs == 0 && nexts == 0) return Interior;
+    if (prevs == 1 && nexts == 1 && *prev != *next) return Boundary;
+    return Locked;
+  }
+
+  // what collapsing u into v would do:
+  struct Plan {
+    float cost = 0.0f;  // largest distance of a removed vertex to the surface
+    uint32_t prev = -1U, next = -1U;  // (if u is on the boundary)
+    std::vector<std::pair<uint32_t, uint32_t>> assigned;  // (vertex, triangle)
+    std::vector<uint32_t> on_edge;  // boundary vertices for prev -> next
+  };
+
+  // (gives up early once the cost would pass 'limit')
+  bool evaluate(uint32_t u, uint32_t v, float limit, Plan *plan) const {
+    if (removed[u] || removed[v] || u == v) return false;
+    plan->prev = plan->next = -1U;
+    plan->assigned.clear();
+    plan->on_edge.clear();
+    Kind kind = classify(u, &plan->prev, &plan->next);
+    if (kind == Locked) return false;
+    if (kind == Boundary && v != plan->prev && v != plan->next) return false;
+
+    // link condition: u and v may only share the neighbors across the
+    // triangles that hold edge uv, or the collapse would pinch the mesh:
+    std::vector<uint32_t> u_ring, v_ring, shared_by_edge;
+    for (uint32_t t : vertex_triangles[u]) {
+      glm::uvec3 const &tri = triangles[t];
+      bool has_v = (tri.x == v || tri.y == v || tri.z == v);
+      for (uint32_t i = 0; i < 3; ++i) {
+        if (tri[i] == u || tri[i] == v) continue;
+        u_ring.emplace_back(tri[i]);
+        if (has_v) shared_by_edge.emplace_back(tri[i]);
+      }
+    }
+    for (uint32_t t : vertex_triangles[v]) {
+      for (uint32_t i = 0; i < 3; ++i) {
+        if (triangles[t][i] != u && triangles[t][i] != v) {
+          v_ring.emplace_back(triangles[t][i]);
+        }
+      }
+    }
+    auto unique = [](std::vector<uint32_t> &list) {
+      std::sort(list.begin(), list.end());
+      list.erase(std::unique(list.begin(), list.end()), list.end());
+    };
+    unique(u_ring);
+    unique(v_ring);
+    unique(shared_by_edge);
+    if (shared_by_edge.empty()) return false;  // (not actually neighbors)
+    std::vector<uint32_t> shared;
+    std::set_intersection(u_ring.begin(), u_ring.end(), v_ring.begin(),
+                          v_ring.end(), std::back_inserter(shared));
+    if (shared != shared_by_edge) return false;
+
+    // the fan around u, before and after:
+    std::vector<uint32_t> kept;
+    float worst_before = 1.0f;
+    for (uint32_t t : vertex_triangles[u]) {
+      glm::uvec3 const &tri = triangles[t];
+      worst_before = std::min(worst_before,
+                              quality(vertices[tri.x], vertices[tri.y],
+                                      vertices[tri.z]));
+      if (tri.x == v || tri.y == v || tri.z == v) continue;
+      kept.emplace_back(t);
+    }
+    if (kept.empty()) return false;
+    float floor = std::min(QualityFloor, worst_before);
+    for (uint32_t t : kept) {
+      glm::uvec3 tri = triangles[t];
+      glm::vec3 before = glm::cross(vertices[tri.y] - vertices[tri.x],
+                                    vertices[tri.z] - vertices[tri.x]);
+      for (uint32_t i = 0; i < 3; ++i) {
+        if (tri[i] == u) tri[i] = v;
+      }
+      glm::vec3 const &a = vertices[tri.x];
+      glm::vec3 const &b = vertices[tri.y];
+      glm::vec3 const &c = vertices[tri.z];
+      if (glm::dot(glm::cross(b - a, c - a), before) <= 0.0f) return false;
+      if (quality(a, b, c) < floor) return false;
+    }
+
+    // every vertex removed so far from around u (and u itself) must stay
+    // close to the new fan:
+    float cost = 0.0f;
+    auto distance = [&](uint32_t p, uint32_t t) {
+      glm::uvec3 tri = triangles[t];
+      for (uint32_t i = 0; i < 3; ++i) {
+        if (tri[i] == u) tri[i] = v;
+      }
+      return distance_to_triangle(vertices[p], vertices[tri.x],
+                                  vertices[tri.y], vertices[tri.z]);
+    };
+    // (vertices usually stay with the triangle they were in, so that's tried
+    //  first; any triangle that doesn't raise the cost will do)
+    auto assign = [&](uint32_t p, uint32_t was_in) {
+      float best = std::numeric_limits<float>::infinity();
+      uint32_t best_t = -1U;
+      if (std::find(kept.begin(), kept.end(), was_in) != kept.end()) {
+        best = distance(p, was_in);
+        best_t = was_in;
+      }
+      for (uint32_t t : kept) {
+        if (best <= cost) break;
+        float d = distance(p, t);
+        if (d < best) {
+          best = d;
+          best_t = t;
+        }
+      }
+      cost = std::max(cost, best);
+      plan->assigned.emplace_back(p, best_t);
+      return best <= limit;
+    };
+    for (uint32_t t : vertex_triangles[u]) {
+      for (uint32_t p : absorbed[t]) {
+        if (!assign(p, t)) return false;
+      }
+    }
+
+    if (kind == Interior) {
+      if (!assign(u, -1U)) return false;
+    } else {
+      // boundary vertices along prev -> u -> next end up along prev -> next:
+      glm::vec3 const &a = vertices[plan->prev];
+      glm::vec3 const &b = vertices[plan->next];
+      plan->on_edge.emplace_back(u);
+      for (auto const &edge : {std::make_pair(plan->prev, u),
+                               std::make_pair(u, plan->next)}) {
+        auto f = edge_absorbed.find(edge);
+        if (f == edge_absorbed.end()) continue;
+        plan->on_edge.insert(plan->on_edge.end(), f->second.begin(),
+                             f->second.end());
+      }
+      for (uint32_t p : plan->on_edge) {
+        float d = distance_to_segment(vertices[p], a, b);
+        if (d > limit) return false;
+        cost = std::max(cost, d);
+      }
+    }
+
+    plan->cost = cost;
+    return true;
+  }
+
+  void collapse(uint32_t u, uint32_t v, Plan const &plan) {
+    auto forget = [this](uint32_t vertex, uint32_t t) {
+      auto &list = vertex_triangles[vertex];
+      list.erase(std::find(list.begin(), list.end(), t));
+    };
+    for (uint32_t t : vertex_triangles[u]) {
+      glm::uvec3 &tri = triangles[t];
+      absorbed[t].clear();
+      if (tri.x == v || tri.y == v || tri.z == v) {
+        alive[t] = 0;
+        for (uint32_t i = 0; i < 3; ++i) {
+          if (tri[i] != u) forget(tri[i], t);
+        }
+      } else {
+        for (uint32_t i = 0; i < 3; ++i) {
+          if (tri[i] == u) tri[i] = v;
+        }
+        vertex_triangles[v].emplace_back(t);
+      }
+    }
+    vertex_triangles[u].clear();
+    removed[u] = 1;
+
+    for (auto const &a : plan.assigned) {
+      absorbed[a.second].emplace_back(a.first);
+    }
+    if (plan.prev != -1U) {
+      edge_absorbed.erase(std::make_pair(plan.prev, u));
+      edge_absorbed.erase(std::make_pair(u, plan.next));
+      edge_absorbed[std::make_pair(plan.prev, plan.next)] = plan.on_edge;
+    }
+  }
+
+  // greedy decimation, cheapest collapse first:
+  void run() {
+    struct Candidate {
+      float cost;
+      uint32_t u, v, stamp;
+      bool operator<(Candidate const &o) const { return cost > o.cost; }
+    };
+    std::priority_queue<Candidate> queue;
+    Plan plan;
+    auto consider = [&](uint32_t u) {
+      ++stamps[u];
+      float best = std::numeric_limits<float>::infinity();
+      uint32_t best_v = -1U;
+      for (uint32_t t : vertex_triangles[u]) {
+        for (uint32_t i = 0; i < 3; ++i) {
+          uint32_t v = triangles[t][i];
+          if (v != u && evaluate(u, v, std::min(best, tolerance), &plan) &&
+              plan.cost < best) {
+            best = plan.cost;
+            best_v = v;
+          }
+        }
+      }
+      if (best_v != -1U) queue.push(Candidate{best, u, best_v, stamps[u]});
+    };
+    for (uint32_t u = 0; u < vertices.size(); ++u) consider(u);
+
+    while (!queue.empty()) {
+      Candidate c = queue.top();
+      queue.pop();
+      if (c.stamp != stamps[c.u] || !evaluate(c.u, c.v, tolerance, &plan)) {
+        continue;
+      }
+      collapse(c.u, c.v, plan);
+
+      // every vertex whose fan changed needs a new best collapse:
+      std::vector<uint32_t> ring;
+      for (uint32_t t : vertex_triangles[c.v]) {
+        for (uint32_t i = 0; i < 3; ++i) ring.emplace_back(triangles[t][i]);
+      }
+      std::sort(ring.begin(), ring.end());
+      ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+      for (uint32_t r : ring) consider(r);
+    }
+  }
+  std::vector<uint32_t> stamps;
+};
+
+// times a few common queries on a walk mesh, in milliseconds each:
+struct QueryTimes {
+  double start_ms = 0.0, walk_ms = 0.0, path_ms = 0.0;
+};
+static QueryTimes time_queries(WalkMesh const &walk_mesh) {
+  auto time_ms = [](std::function<void()> const &fn) {
+    auto before = std::chrono::high_resolution_clock::now();
+    fn();
+    auto after = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(after - before).count();
+  };
+
+  std::mt19937 mt(0x5e1f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  glm::vec3 min(std::numeric_limits<float>::infinity());
+  glm::vec3 max(-std::numeric_limits<float>::infinity());
+  for (auto const &v : walk_mesh.vertices) {
+    min = glm::min(min, v);
+    max = glm::max(max, v);
+  }
+  std::vector<glm::vec3> points(10000);
+  for (auto &p : points) {
+    p = min + (max - min) * glm::vec3(unit(mt), unit(mt), unit(mt));
+  }
+
+  QueryTimes times;
+  std::vector<WalkMesh::WalkPoint> walk_points(points.size());
+  times.start_ms = time_ms([&]() {
+    for (uint32_t i = 0; i < points.size(); ++i) {
+      walk_points[i] = walk_mesh.start(points[i]);
+    }
+  });
+  std::vector<glm::vec3> steps(points.size());
+  float length = 0.05f * glm::length(max - min);
+  for (auto &step : steps) {
+    step = glm::vec3(unit(mt) - 0.5f, unit(mt) - 0.5f, 0.0f) * length;
+  }
+  times.walk_ms = time_ms([&]() {
+    for (uint32_t round = 0; round < 10; ++round) {
+      for (uint32_t i = 0; i < points.size(); ++i) {
+        walk_mesh.walk(walk_points[i], steps[i]);
+      }
+    }
+  });
+  WalkPathfinder pathfinder(walk_mesh, 1);
+  std::vector<glm::vec3> path;
+  times.path_ms = time_ms([&]() {
+    for (uint32_t i = 0; i + 1 < 2000; i += 2) {
+      pathfinder.find_path(walk_points[i], walk_points[i + 1], &path);
+    }
+  });
+  return times;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage:\n\t" << argv[0] << " <in.blob> <out.blob> [tolerance]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    WalkMesh walk_mesh(argv[1]);
+    if (!walk_mesh.triangle_borders.empty()) {
+      throw std::runtime_error("'" + std::string(argv[1]) +
+                               "' is a tile; simplify before splitting.");
+    }
+    float tolerance = (argc >= 4 ? std::stof(argv[3]) : 0.05f);
+    if (!(tolerance >= 0.0f)) {
+      throw std::runtime_error("Tolerance must not be negative.");
+    }
+
+    auto before = std::chrono::high_resolution_clock::now();
+    Simplifier simplifier(walk_mesh.vertices, walk_mesh.triangles, tolerance);
+    simplifier.run();
+
+    // keep the vertices still in use, in their original order:
+    std::vector<uint32_t> remap(walk_mesh.vertices.size(), -1U);
+    std::vector<glm::vec3> vertices, normals;
+    std::vector<glm::uvec3> triangles;
+    for (uint32_t t = 0; t < simplifier.triangles.size(); ++t) {
+      if (!simplifier.alive[t]) continue;
+      for (uint32_t i = 0; i < 3; ++i) {
+        remap[simplifier.triangles[t][i]] = 0;
+      }
+    }
+    for (uint32_t v = 0; v < remap.size(); ++v) {
+      if (remap[v] == -1U) continue;
+      remap[v] = uint32_t(vertices.size());
+      vertices.emplace_back(walk_mesh.vertices[v]);
+      normals.emplace_back(walk_mesh.vertex_normals[v]);
+    }
+    for (uint32_t t = 0; t < simplifier.triangles.size(); ++t) {
+      if (!simplifier.alive[t]) continue;
+      glm::uvec3 const &tri = simplifier.triangles[t];
+      triangles.emplace_back(remap[tri.x], remap[tri.y], remap[tri.z]);
+    }
+    auto after = std::chrono::high_resolution_clock::now();
+
+    std::ofstream out(argv[2], std::ios::binary);
+    write_chunk(out, "vtx0", vertices);
+    write_chunk(out, "tri0", triangles);
+    write_chunk(out, "nom0", normals);
+    out.close();
+
+    std::cout << "Simplified '" << argv[1] << "' from "
+              << walk_mesh.triangles.size() << " to " << triangles.size()
+              << " triangles (" << walk_mesh.vertices.size() << " to "
+              << vertices.size() << " vertices) in "
+              << std::chrono::duration<double, std::milli>(after - before)
+                     .count()
+              << " ms; wrote '" << argv[2] << "'." << std::endl;
+
+    // measure what was promised: every original vertex (that was in use)
+    // should be within tolerance of the simplified mesh:
+    WalkMesh simplified(argv[2]);
+    float deviation = 0.0f;
+    for (auto const &tri : walk_mesh.triangles) {
+      for (uint32_t i = 0; i < 3; ++i) {
+        glm::vec3 const &v = walk_mesh.vertices[tri[i]];
+        deviation = std::max(
+            deviation,
+            glm::distance(simplified.world_point(simplified.start(v)), v));
+      }
+    }
+    std::cout << "Largest distance from an original vertex to the simplified "
+                 "mesh: "
+              << deviation << " (tolerance " << tolerance << ")." << std::endl;
+
+    QueryTimes old_times = time_queries(walk_mesh);
+    QueryTimes new_times = time_queries(simplified);
+    auto report = [](char const *name, double old_ms, double new_ms) {
+      std::cout << "  " << name << old_ms << " ms -> " << new_ms << " ms ("
+                << old_ms / new_ms << "x)\n";
+    };
+    std::cout << "Query times, before -> after:\n";
+    report("10000 start()          ", old_times.start_ms, new_times.start_ms);
+    report("100000 walk()          ", old_times.walk_ms, new_times.walk_ms);
+    report("1000 find_path()       ", old_times.path_ms, new_times.path_ms);
+    std::cout.flush();
+  } catch (std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,304 @@
+// stress_walk_mesh runs lots of random walks over the phone bank walk mesh and
+// some generated ones, checking after every step that the walk point is still
+// sane, and reports how fast walking went:
+//   stress-walk-mesh [walkers] [rounds] [seed]
+// Each round, every walker takes one random step (mostly short, sometimes
+// long enough to cross many triangles, sometimes zero or tiny). Invariants:
+//  - the triangle exists (and wasn't carved away) and the weights are finite,
+//    non-negative, and sum to 1 -- so the point stays on the mesh; a sample of
+//    points is also checked against start(), from scratch.
+//  - no step is lost: whatever part of the step walk() didn't use comes back
+//    in 'remaining', and the point never moves further than asked.
+//    On the flat meshes, steps that stay clear of the edges must move the
+//    point by exactly the step.
+// Exits with 1 if any check failed.
+
+#include "WalkMesh.hpp"
+#include "data_path.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// a square walk mesh 'size' units on a side, made of 'cells' x 'cells' squares
+// (two triangles each); interior vertices are moved up to 'jitter' of a cell
+// in x and y, and 'height' gives the z of each vertex:
+// (keep jitter below 1/6 so no triangle can be flipped over)
+static WalkMesh grid_walk_mesh(float size, uint32_t cells, float jitter,
+                               std::function<float(glm::vec2)> const &height,
+                               std::mt19937 &mt) {
+  std::uniform_real_distribution<float> offset(-jitter, jitter);
+  float cell = size / cells;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::uvec3> triangles;
+  for (uint32_t y = 0; y <= cells; ++y) {
+    for (uint32_t x = 0; x <= cells; ++x) {
+      glm::vec2 at = glm::vec2(x, y) * cell;
+      if (x > 0 && x < cells && y > 0 && y < cells) {
+        at += glm::vec2(offset(mt), offset(mt)) * cell;
+      }
+      vertices.emplace_back(at, height(at));
+    }
+  }
+  for (uint32_t y = 0; y < cells; ++y) {
+    for (uint32_t x = 0; x < cells; ++x) {
+      uint32_t a = y * (cells + 1) + x;
+      uint32_t b = a + 1;
+      uint32_t c = a + (cells + 1);
+      uint32_t d = c + 1;
+      triangles.emplace_back(a, b, d);
+      triangles.emplace_back(a, d, c);
+    }
+  }
+
+  // area-weighted vertex normals:
+  std::vector<glm::vec3> normals(vertices.size(), glm::vec3(0.0f));
+  for (auto const &tri : triangles) {
+    glm::vec3 n = glm::cross(vertices[tri.y] - vertices[tri.x],
+                             vertices[tri.z] - vertices[tri.x]);
+    normals[tri.x] += n;
+    normals[tri.y] += n;
+    normals[tri.z] += n;
+  }
+  for (auto &n : normals) n = glm::normalize(n);
+
+  return WalkMesh(vertices, triangles, normals);
+}
+
+// a mesh to stress, and what to expect of it:
+struct Case {
+  std::string name;
+  WalkMesh walk_mesh;
+  float scale;  // typical edge length
+  bool flat;    // in the z = 0 plane, with the square [0, size]^2 as boundary
+  float size;
+};
+
+struct Totals {
+  uint64_t steps = 0;
+  uint64_t crossings = 0;
+  uint64_t truncated = 0;  // steps cut short (by the budget or a border)
+  double walk_ms = 0.0;
+  uint64_t failures = 0;
+};
+
+static Totals stress(Case const &c, uint32_t walkers, uint32_t rounds,
+                     std::mt19937 &mt) {
+  WalkMesh const &walk_mesh = c.walk_mesh;
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+
+  // extent of the mesh sets the tolerances and the longest steps:
+  glm::vec3 min(std::numeric_limits<float>::infinity());
+  glm::vec3 max(-std::numeric_limits<float>::infinity());
+  for (auto const &v : walk_mesh.vertices) {
+    min = glm::min(min, v);
+    max = glm::max(max, v);
+  }
+  float extent = glm::length(max - min);
+  float const tolerance = 1e-4f * extent;
+
+  std::vector<WalkMesh::WalkPoint> points(walkers);
+  for (auto &wp : points) {
+    wp = walk_mesh.start(min + (max - min) * glm::vec3(unit(mt), unit(mt),
+                                                       unit(mt)));
+  }
+
+  std::vector<glm::vec3> steps(walkers);
+  std::vector<glm::vec3> before(walkers);
+  std::vector<WalkMesh::WalkResult> results(walkers);
+  uint32_t const max_crossings = 64;
+
+  Totals totals;
+  auto fail = [&](uint32_t i, char const *what) {
+    if (totals.failures < 10) {
+      WalkMesh::WalkPoint const &wp = points[i];
+      std::cout << "  FAILED (" << what << "): walker " << i << " triangle "
+                << wp.triangle << " weights " << wp.weights.x << " "
+                << wp.weights.y << " " << wp.weights.z << " step "
+                << steps[i].x << " " << steps[i].y << " " << steps[i].z
+                << " consumed " << results[i].consumed << "\n";
+    }
+    ++totals.failures;
+  };
+
+  for (uint32_t round = 0; round < rounds; ++round) {
+    for (uint32_t i = 0; i < walkers; ++i) {
+      glm::vec3 dir = glm::vec3(normal(mt), normal(mt), normal(mt));
+      float kind = unit(mt);
+      float length;
+      if (kind < 0.02f) {
+        length = 0.0f;
+      } else if (kind < 0.05f) {
+        length = 1e-6f * c.scale * unit(mt);
+      } else if (kind < 0.85f) {
+        length = 0.5f * c.scale * unit(mt);
+      } else if (kind < 0.98f) {
+        length = 8.0f * c.scale * unit(mt);
+      } else {
+        length = extent * unit(mt);  // (may run out of crossings)
+      }
+      float dir_length = glm::length(dir);
+      steps[i] = (dir_length > 0.0f ? dir * (length / dir_length)
+                                    : glm::vec3(0.0f));
+      before[i] = walk_mesh.world_point(points[i]);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < walkers; ++i) {
+      results[i] = walk_mesh.walk(points[i], steps[i], max_crossings);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    totals.walk_ms +=
+        std::chrono::duration<double, std::milli>(end - start).count();
+
+    for (uint32_t i = 0; i < walkers; ++i) {
+      WalkMesh::WalkPoint const &wp = points[i];
+      WalkMesh::WalkResult const &result = results[i];
+      totals.steps += 1;
+      totals.crossings += result.crossings;
+
+      // the point is somewhere on the mesh:
+      if (wp.triangle >= walk_mesh.triangles.size() ||
+          walk_mesh.removed(wp.triangle)) {
+        fail(i, "bad triangle");
+        continue;
+      }
+      glm::vec3 const &w = wp.weights;
+      if (!(std::isfinite(w.x) && std::isfinite(w.y) && std::isfinite(w.z))) {
+        fail(i, "weights not finite");
+        continue;
+      }
+      if (w.x < 0.0f || w.y < 0.0f || w.z < 0.0f) {
+        fail(i, "negative weight");
+      }
+      if (std::abs(w.x + w.y + w.z - 1.0f) > 1e-5f) {
+        fail(i, "weights don't sum to 1");
+      }
+      glm::vec3 after = walk_mesh.world_point(wp);
+      if (i % 64 == round % 64) {
+        WalkMesh::WalkPoint check = walk_mesh.start(after);
+        if (glm::distance(walk_mesh.world_point(check), after) > tolerance) {
+          fail(i, "point is off the mesh");
+        }
+      }
+
+      // the step was used up (or there's a reason it wasn't), and the point
+      // moved no further than asked:
+      float step_length = glm::length(steps[i]);
+      if (!(result.consumed >= 0.0f && result.consumed <= 1.0f + 1e-5f)) {
+        fail(i, "consumed out of range");
+      } else if (result.consumed < 1.0f - 1e-4f) {
+        // (whatever wasn't used must come back in 'remaining')
+        float left = glm::length(result.remaining);
+        if (std::abs(left - (1.0f - result.consumed) * step_length) >
+            1e-3f * step_length) {
+          fail(i, "step lost");
+        } else {
+          ++totals.truncated;
+        }
+      }
+      float moved = glm::distance(after, before[i]);
+      if (moved > step_length + tolerance) fail(i, "moved too far");
+      if (c.flat) {
+        // (the floor is the z = 0 plane, so walking just drops the step's z;
+        //  any part of the step that was cut short comes back in 'remaining')
+        glm::vec2 target = glm::vec2(before[i]) + glm::vec2(steps[i]) -
+                           glm::vec2(result.remaining);
+        float margin = c.scale;
+        if (target.x > margin && target.y > margin &&
+            target.x < c.size - margin && target.y < c.size - margin &&
+            glm::distance(glm::vec2(after), target) > tolerance) {
+          fail(i, "flat step went astray");
+        }
+      }
+    }
+  }
+  return totals;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 4) {
+    std::cerr << "Usage:\n\t" << argv[0] << " [walkers] [rounds] [seed]"
+              << std::endl;
+    return 1;
+  }
+  uint32_t walkers = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 10000);
+  uint32_t rounds = (argc > 2 ? uint32_t(std::stoul(argv[2])) : 200);
+  uint32_t seed = (argc > 3 ? uint32_t(std::stoul(argv[3])) : 0x5724e55);
+
+  std::mt19937 mt(seed);
+  std::vector<Case> cases;
+  try {
+    cases.push_back(Case{"phone bank",
+                         WalkMesh(data_path("phone-bank-walk.blob")), 1.0f,
+                         false, 0.0f});
+  } catch (std::exception const &e) {
+    std::cerr << "Skipping the phone bank: " << e.what() << std::endl;
+  }
+  auto flat = [](glm::vec2) { return 0.0f; };
+  cases.push_back(Case{"flat, jittered",
+                       grid_walk_mesh(32.0f, 64, 0.15f, flat, mt), 0.5f, true,
+                       32.0f});
+  cases.push_back(Case{"rolling hills",
+                       grid_walk_mesh(32.0f, 64, 0.15f,
+                                      [](glm::vec2 p) {
+                                        return 2.0f * std::sin(0.5f * p.x) *
+                                               std::cos(0.3f * p.y);
+                                      },
+                                      mt),
+                       0.5f, false, 0.0f});
+  // cells 64 times longer than wide, with the diagonals making slivers:
+  cases.push_back(Case{"slivers",
+                       [&mt]() {
+                         WalkMesh mesh =
+                             grid_walk_mesh(1.0f, 64, 0.0f, [](glm::vec2) {
+                               return 0.0f;
+                             }, mt);
+                         for (auto &v : mesh.vertices) v.x *= 64.0f;
+                         return WalkMesh(mesh.vertices, mesh.triangles,
+                                         mesh.vertex_normals);
+                       }(),
+                       0.5f, false, 0.0f});
+  // a floor with crates carved out of it:
+  cases.push_back(Case{"carved",
+                       grid_walk_mesh(32.0f, 64, 0.15f, flat, mt), 0.5f, false,
+                       0.0f});
+  {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    WalkMesh &carved = cases.back().walk_mesh;
+    for (uint32_t i = 0; i < 40; ++i) {
+      glm::vec2 at = glm::vec2(unit(mt), unit(mt)) * 32.0f;
+      float angle = 6.2831853f * unit(mt);
+      glm::vec2 x =
+          glm::vec2(std::cos(angle), std::sin(angle)) * (0.3f + unit(mt));
+      glm::vec2 y = glm::vec2(-x.y, x.x);
+      carved.carve({at - x - y, at + x - y, at + x + y, at - x + y}, -1.0f,
+                   1.0f);
+    }
+  }
+
+  std::cout << walkers << " walkers x " << rounds << " rounds, seed " << seed
+            << ":\n";
+  uint64_t failures = 0;
+  for (auto const &c : cases) {
+    std::cout << c.name << " (" << c.walk_mesh.triangles.size()
+              << " triangles):\n";
+    Totals totals = stress(c, walkers, rounds, mt);
+    double seconds = totals.walk_ms / 1000.0;
+    std::cout << "  " << totals.steps << " steps, " << totals.crossings
+              << " crossings, " << totals.truncated << " cut short; "
+              << totals.steps / seconds << " steps/s, "
+              << totals.crossings / seconds << " crossings/s; "
+              << totals.failures << " failed checks\n";
+    failures += totals.failures;
+  }
+  std::cout.flush();
+  return (failures == 0 ? 0 : 1);
+}
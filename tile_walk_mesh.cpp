@@ -0,0 +1,46 @@
+// tile_walk_mesh splits a walk mesh into square tiles that the game can
+// stream in and out (see WalkTiles.hpp); it writes an index file plus one
+// baked walk mesh file per tile (named <out.tiles>.<tile number>):
+//   tile-walk-mesh <in.blob> <out.tiles> <tile size>
+
+#include "WalkMesh.hpp"
+#include "WalkTiles.hpp"
+
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    std::cerr << "Usage:\n\t" << argv[0]
+              << " <in.blob> <out.tiles> <tile size>" << std::endl;
+    return 1;
+  }
+
+  try {
+    WalkMesh walk_mesh(argv[1]);
+    float tile_size = std::stof(argv[3]);
+    if (!(tile_size > 0.0f)) {
+      throw std::runtime_error("Tile size must be positive.");
+    }
+
+    auto before = std::chrono::high_resolution_clock::now();
+    WalkTiles::split(walk_mesh, tile_size, argv[2]);
+    auto after = std::chrono::high_resolution_clock::now();
+
+    WalkTiles tiles(argv[2]);
+    uint32_t count = 0;
+    for (auto const &tile : tiles.tiles) {
+      if (tile.exists) ++count;
+    }
+    std::cout << "Split '" << argv[1] << "' into " << count << " tiles ("
+              << tiles.columns << "x" << tiles.rows << " grid) with "
+              << tiles.links.size() << " border links in "
+              << std::chrono::duration<double, std::milli>(after - before)
+                     .count()
+              << " ms; wrote '" << argv[2] << "'." << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
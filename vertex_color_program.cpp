@@ -1,13 +1,29 @@
 #include "vertex_color_program.hpp"
 
 #include "compile_program.hpp"
+#include "Scene.hpp"
 
-VertexColorProgram::VertexColorProgram() {
+#include <string>
+
+VertexColorProgram::VertexColorProgram(bool instanced) {
   program = compile_program(
-      "#version 330\n"
-      "uniform mat4 object_to_clip;\n"
-      "uniform mat4x3 object_to_light;\n"
-      "uniform mat3 normal_to_light;\n"
+      std::string("#version 330\n")
+      + (instanced ?
+        //(at the locations Scene::draw binds its instance data to)
+        "layout(location=" + std::to_string(Scene::InstanceObjectToClipLocation) + ") in mat4 Instance_object_to_clip;\n"
+        "layout(location=" + std::to_string(Scene::InstanceObjectToLightLocation) + ") in mat4x3 Instance_object_to_light;\n"
+        "layout(location=" + std::to_string(Scene::InstanceNormalToLightLocation) + ") in mat3 Instance_normal_to_light;\n"
+        "#define object_to_clip Instance_object_to_clip\n"
+        "#define object_to_light Instance_object_to_light\n"
+        "#define normal_to_light Instance_normal_to_light\n"
+      : std::string(
+        //(layout must match Scene::ObjectMatrices)
+        "layout(std140) uniform ObjectMatrices {\n"
+        "	mat4 object_to_clip;\n"
+        "	mat4x3 object_to_light;\n"
+        "	mat3 normal_to_light;\n"
+        "};\n"
+      )) +
       "layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
       "in vec3 Normal;\n"
       "in vec4 Color;\n"
@@ -46,9 +62,10 @@ VertexColorProgram::VertexColorProgram() {
       "}\n"
   );
 
-  object_to_clip_mat4 = glGetUniformLocation(program, "object_to_clip");
-  object_to_light_mat4x3 = glGetUniformLocation(program, "object_to_light");
-  normal_to_light_mat3 = glGetUniformLocation(program, "normal_to_light");
+  if (!instanced) {
+    object_matrices_block = glGetUniformBlockIndex(program, "ObjectMatrices");
+    glUniformBlockBinding(program, object_matrices_block, Scene::ObjectMatricesBinding);
+  }
 
   sun_direction_vec3 = glGetUniformLocation(program, "sun_direction");
   sun_color_vec3 = glGetUniformLocation(program, "sun_color");
@@ -59,3 +76,7 @@ VertexColorProgram::VertexColorProgram() {
 Load<VertexColorProgram> vertex_color_program(LoadTagInit, []() {
   return new VertexColorProgram();
 });
+
+Load<VertexColorProgram> vertex_color_program_instanced(LoadTagInit, []() {
+  return new VertexColorProgram(true);
+});
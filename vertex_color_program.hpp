@@ -5,16 +5,19 @@ struct VertexColorProgram {
   //opengl program object:
   GLuint program = 0;
 
+  //uniform block index for the matrices (a Scene::ObjectMatrices block):
+  GLuint object_matrices_block = -1U;
+
   //uniform locations:
-  GLuint object_to_clip_mat4 = -1U;
-  GLuint object_to_light_mat4x3 = -1U;
-  GLuint normal_to_light_mat3 = -1U;
   GLuint sun_direction_vec3 = -1U;
   GLuint sun_color_vec3 = -1U;
   GLuint sky_direction_vec3 = -1U;
   GLuint sky_color_vec3 = -1U;
 
-  VertexColorProgram();
+  //'instanced' builds a variant that reads the three matrices from per-instance attributes instead of the uniform block:
+  // (laid out as Scene::InstanceData, at the locations Scene::draw binds them to; object_matrices_block stays -1U)
+  VertexColorProgram(bool instanced = false);
 };
 
 extern Load<VertexColorProgram> vertex_color_program;
+extern Load<VertexColorProgram> vertex_color_program_instanced;